@@ -0,0 +1,238 @@
+// Runs the evaluator on each workload a few times and prints one JSON object
+// per line with its median and fastest wall time, beta reductions per
+// second, allocations and peak RSS. The counters come from the evaluator's
+// `--stats` report on stderr, which is the same on every run.
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_ARGS 64
+
+typedef struct {
+    unsigned long long betas;
+    unsigned long long allocations;
+    unsigned long long peak_nodes;
+} counters;
+
+// the outcome of one run of the evaluator
+typedef struct {
+    double wall;
+    int status;
+    long peak_rss_kb;
+    counters counters;
+} sample;
+
+unsigned timeout = 60;
+int runs = 5;
+
+void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [--timeout=SECONDS] [--runs=N] <evaluator>"
+            " [evaluator options] <workload.lc>...\n",
+            program);
+    exit(1);
+}
+
+bool is_workload(const char *arg) {
+    size_t len = strlen(arg);
+    return len > 3 && strcmp(arg + len - 3, ".lc") == 0;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// prints `str` as a JSON string
+void print_string(const char *str) {
+    putchar('"');
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\') putchar('\\');
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+// reads the `name value` lines of a --stats report
+void parse_counters(const char *report, counters *c) {
+    const char *line = report;
+    while (line != NULL && *line != '\0') {
+        char name[32];
+        unsigned long long value;
+        if (sscanf(line, "%31s %llu", name, &value) == 2) {
+            if (strcmp(name, "betas") == 0) c->betas = value;
+            else if (strcmp(name, "allocations") == 0) c->allocations = value;
+            else if (strcmp(name, "peak_nodes") == 0) c->peak_nodes = value;
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) line++;
+    }
+}
+
+int by_wall(const void *a, const void *b) {
+    double x = ((const sample*)a)->wall, y = ((const sample*)b)->wall;
+    return (x > y) - (x < y);
+}
+
+// runs the evaluator `argv` on one workload once
+sample run_once(char **argv, size_t argc, const char *workload) {
+    int err[2];
+    if (pipe(err) != 0) {
+        fprintf(stderr, "ERROR: pipe failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    argv[argc] = (char*)workload;
+    argv[argc+1] = NULL;
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "ERROR: fork failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        close(err[0]);
+        // the alarm outlives exec and kills a runaway workload
+        alarm(timeout);
+        execv(argv[0], argv);
+        fprintf(stderr, "ERROR: could not run %s: %s\n",
+                argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(err[1]);
+
+    char *report = NULL;
+    size_t len = 0, cap = 0;
+    for (;;) {
+        if (len + 1024 > cap) {
+            cap = cap == 0 ? 4096 : cap * 2;
+            char *grown = realloc(report, cap);
+            if (grown == NULL) {
+                fprintf(stderr, "ERROR: out of memory\n");
+                exit(1);
+            }
+            report = grown;
+        }
+        ssize_t n = read(err[0], report + len, cap - len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += n;
+    }
+    report[len] = '\0';
+    close(err[0]);
+
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "ERROR: wait failed: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    sample s = {now() - start, status, usage.ru_maxrss, {0}};
+    parse_counters(report, &s.counters);
+    free(report);
+    return s;
+}
+
+// Runs the evaluator `argv` on one workload `runs` times, or until a run
+// fails, and prints its report line. A single run of a small workload is
+// mostly noise, so the median and the fastest run are reported.
+void run(char **argv, size_t argc, const char *options, const char *workload) {
+    sample samples[runs];
+    int done = 0;
+    int status = 0;
+    while (done < runs) {
+        samples[done] = run_once(argv, argc, workload);
+        status = samples[done++].status;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) break;
+    }
+    counters c = samples[done-1].counters;
+    long peak_rss_kb = 0;
+    for (int i = 0; i < done; i++) {
+        if (samples[i].peak_rss_kb > peak_rss_kb) {
+            peak_rss_kb = samples[i].peak_rss_kb;
+        }
+    }
+    qsort(samples, done, sizeof(sample), by_wall);
+    double wall = done % 2 == 1 ? samples[done/2].wall
+        : (samples[done/2 - 1].wall + samples[done/2].wall) / 2;
+    double fastest = samples[0].wall;
+
+    char result[32];
+    if (WIFSIGNALED(status)) {
+        snprintf(result, sizeof(result), "signal %d", WTERMSIG(status));
+    } else if (WEXITSTATUS(status) != 0) {
+        snprintf(result, sizeof(result), "exit %d", WEXITSTATUS(status));
+    } else {
+        snprintf(result, sizeof(result), "ok");
+    }
+
+    printf("{\"workload\": ");
+    print_string(workload);
+    printf(", \"options\": ");
+    print_string(options);
+    printf(", \"status\": ");
+    print_string(result);
+    printf(", \"runs\": %d, \"wall_s\": %.6f, \"wall_min_s\": %.6f,"
+           " \"betas\": %llu, \"betas_per_s\": %.0f,"
+           " \"allocations\": %llu, \"peak_nodes\": %llu,"
+           " \"peak_rss_kb\": %ld}\n",
+           done, wall, fastest, c.betas, wall > 0 ? c.betas / wall : 0.0,
+           c.allocations, c.peak_nodes, peak_rss_kb);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    int i = 1;
+    for (; i < argc; i++) {
+        if (strncmp(argv[i], "--timeout=", 10) == 0) {
+            timeout = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            runs = atoi(argv[i] + 7);
+            if (runs < 1) usage(argv[0]);
+        } else {
+            break;
+        }
+    }
+    if (i >= argc) usage(argv[0]);
+
+    // the evaluator, its options and `--stats`, then room for the workload
+    char *child[MAX_ARGS + 4];
+    size_t child_len = 0;
+    child[child_len++] = argv[i++];
+    child[child_len++] = "--stats";
+
+    char options[1024] = "";
+    int first = i;
+    for (; i < argc && !is_workload(argv[i]); i++) {
+        if (child_len == MAX_ARGS) {
+            fprintf(stderr, "ERROR: too many evaluator options\n");
+            exit(1);
+        }
+        child[child_len++] = argv[i];
+        size_t room = sizeof(options) - strlen(options) - 1;
+        if (i > first && room > 0) {
+            strcat(options, " ");
+            room--;
+        }
+        strncat(options, argv[i], room);
+    }
+    if (i == argc) usage(argv[0]);
+
+    for (; i < argc; i++) run(child, child_len, options, argv[i]);
+    return 0;
+}
@@ -1,550 +1,7139 @@
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <poll.h>
 
-#define DEBUG
+// work counters, reported with --stats
+typedef struct {
+    uint64_t betas;         // beta reductions, in every strategy
+    uint64_t unfoldings;    // definitions copied or entered by name
+    uint64_t memo_hits;     // unfoldings served from a kept normal form
+    uint64_t clones;        // calls of clone
+    uint64_t clone_nodes;   // nodes copied by clone
+    uint64_t renames;       // binders given a fresh generation
+    uint64_t interactions;  // rewrites of interaction net nodes
+    uint64_t allocations;   // term nodes, thunks, cells, envs and net nodes
+    uint64_t malloc_bytes;  // bytes asked of malloc and realloc
+    uint64_t parsed;        // definitions parsed into terms
+    double parse_time;      // seconds, measured only with --stats
+    double eval_time;
+    double readback_time;
+    double print_time;
+} counters;
+
+// the counters, in the order they are reported
+#define STATS_COUNTERS(X)                       \
+    X(betas)                                    \
+    X(unfoldings)                               \
+    X(memo_hits)                                \
+    X(clones)                                   \
+    X(clone_nodes)                              \
+    X(renames)                                  \
+    X(interactions)                             \
+    X(allocations)                              \
+    X(malloc_bytes)                             \
+    X(parsed)
+
+#define STATS_TIMES(X)                          \
+    X(parse, parse_time)                        \
+    X(eval, eval_time)                          \
+    X(readback, readback_time)                  \
+    X(print, print_time)
+
+// each thread counts on its own; workers add theirs to the main thread's
+// when they stop
+_Thread_local counters stats = {0};
+bool show_stats = false;
+
+double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a timer for one of the phases, which only reads the clock with --stats
+double timer_start(void) {
+    return show_stats ? seconds() : 0;
+}
+
+void timer_stop(double start, double *total) {
+    if (show_stats) *total += seconds() - start;
+}
+
+// bytes asked of malloc after which the memory limit is next looked at
+extern _Thread_local uint64_t memory_mark;
+extern _Thread_local uint32_t ticks;
+
+// malloc and realloc, counted, stopping the program when memory runs out
+void *allocate(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    stats.malloc_bytes += size;
+    if (stats.malloc_bytes >= memory_mark) ticks = 1;
+    return ptr;
+}
+
+void *reallocate(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        exit(1);
+    }
+    stats.malloc_bytes += size;
+    if (stats.malloc_bytes >= memory_mark) ticks = 1;
+    return ptr;
+}
+
+// While the server answers a query, an error in it, like a parse error or
+// recursion, is reported to the client and abandons only that query.
+_Thread_local FILE *query_out = NULL;
+_Thread_local jmp_buf *query_abort = NULL;
+
+// where errors in the input are reported
+FILE *error_out(void) {
+    return query_out != NULL ? query_out : stderr;
+}
+
+// gives up on the input once the error has been reported
+_Noreturn void give_up(void) {
+    if (query_abort != NULL) longjmp(*query_abort, 1);
+    exit(1);
+}
+
+// Limits on one evaluation, from the command line, 0 for none. Untrusted
+// terms may diverge, so the hot loops count down `ticks` as they count their
+// work, and only every LIMIT_TICKS units look at the clock and the memory.
+// The count is cut short so that the step limit is met exactly, and once
+// LIMIT_BYTES more have been asked of malloc, so that memory is looked at
+// again before it grows by much more than that.
+typedef struct {
+    uint64_t steps;     // beta reductions
+    uint64_t memory;    // bytes resident, above what the process held before
+    double seconds;     // of wall time
+} limits;
+
+#define LIMIT_TICKS 65536
+#define LIMIT_BYTES (4 << 20)
+#define EXIT_LIMIT  3   // the exit code when a limit stops evaluation
+
+limits limit = {0};
+
+// where the evaluation a thread runs started, to measure it against limits
+typedef struct {
+    uint64_t betas;
+    uint64_t resident;  // bytes the process held
+    double started;
+    double deadline;
+} budget;
+
+_Thread_local budget eval_budget = {0};
+budget workers_budget = {0};    // of the evaluation the workers help with
+_Thread_local uint32_t ticks = LIMIT_TICKS;
+_Thread_local uint64_t memory_mark = UINT64_MAX;
+
+// counts a unit of work
+#define WORK(counter) do {                                              \
+        stats.counter++;                                                \
+        if (--ticks == 0) check_limits();                               \
+    } while (0)
+
+// bytes of memory the process holds, or 0 if that cannot be told
+uint64_t resident_bytes(void) {
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL) return 0;
+    unsigned long long pages = 0;
+    if (fscanf(file, "%*s %llu", &pages) != 1) pages = 0;
+    fclose(file);
+    return pages * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+// counts down to the next look at the limits
+void wind_ticks(void) {
+    ticks = LIMIT_TICKS;
+    if (limit.steps != 0) {
+        // every beta reduction is a unit of work, so none goes unchecked
+        uint64_t used = stats.betas - eval_budget.betas;
+        if (used < limit.steps && limit.steps - used < ticks) {
+            ticks = limit.steps - used;
+        } else if (used >= limit.steps) {
+            ticks = 1;
+        }
+    }
+    memory_mark = limit.memory != 0 ? stats.malloc_bytes + LIMIT_BYTES
+                                    : UINT64_MAX;
+}
+
+void start_budget(void) {
+    eval_budget.betas = stats.betas;
+    eval_budget.resident = limit.memory != 0 ? resident_bytes() : 0;
+    eval_budget.started = seconds();
+    eval_budget.deadline = eval_budget.started + limit.seconds;
+    wind_ticks();
+}
+
+// Stops the evaluation if it went over a limit, reporting how far it got.
+// A query being served is abandoned, anything else exits with EXIT_LIMIT.
+// Memory is measured from where the evaluation started, so a server that
+// once grew for a query does not hold that against the next ones.
+void check_limits(void) {
+    wind_ticks();
+    if (eval_budget.started == 0) return;   // work done before evaluating
+    const char *what = NULL;
+    double now = seconds();
+    if (limit.steps != 0 && stats.betas - eval_budget.betas >= limit.steps) {
+        what = "step";
+    } else if (limit.seconds > 0 && now >= eval_budget.deadline) {
+        what = "time";
+    } else if (limit.memory != 0
+               && resident_bytes() >= eval_budget.resident + limit.memory) {
+        what = "memory";
+    }
+    if (what == NULL) return;
+    fprintf(error_out(), "ERROR: the %s limit stopped evaluation after "
+            "%llu beta reductions and %llu allocations in %.3f seconds\n",
+            what, (unsigned long long)(stats.betas - eval_budget.betas),
+            (unsigned long long)stats.allocations,
+            now - eval_budget.started);
+    if (query_abort != NULL) longjmp(*query_abort, 1);
+    exit(EXIT_LIMIT);
+}
+
+// symbols are interned names, compared as integers
+typedef uint32_t symbol;
+
+#define NO_SYMBOL UINT32_MAX
+
+typedef struct {
+    const char **names;
+    size_t len;
+    size_t cap;
+    symbol *slots;      // open addressing, NO_SYMBOL marks an empty slot
+    size_t slot_cap;    // always a power of two
+} symbol_table;
+
+// Server threads parse queries while others print results, so interning
+// takes a lock and a names array that has been outgrown is never freed:
+// symbol_name may still be reading it on another thread.
+symbol_table symbols = {0};
+pthread_mutex_t symbols_lock = PTHREAD_MUTEX_INITIALIZER;
+
+size_t hash_name(const char *str, size_t len) {
+    // FNV-1a
+    size_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void symbols_grow(void) {
+    size_t cap = symbols.slot_cap == 0 ? 64 : symbols.slot_cap * 2;
+    symbol *slots = allocate(cap * sizeof(symbol));
+    for (size_t i = 0; i < cap; i++) slots[i] = NO_SYMBOL;
+    for (size_t i = 0; i < symbols.len; i++) {
+        size_t h = hash_name(symbols.names[i], strlen(symbols.names[i]));
+        while (slots[h & (cap-1)] != NO_SYMBOL) h++;
+        slots[h & (cap-1)] = i;
+    }
+    free(symbols.slots);
+    symbols.slots = slots;
+    symbols.slot_cap = cap;
+}
+
+symbol intern(const char *str, size_t len) {
+    pthread_mutex_lock(&symbols_lock);
+    if ((symbols.len+1) * 2 > symbols.slot_cap) symbols_grow();
+
+    size_t h = hash_name(str, len);
+    for (;; h++) {
+        symbol sym = symbols.slots[h & (symbols.slot_cap-1)];
+        if (sym == NO_SYMBOL) break;
+        const char *name = symbols.names[sym];
+        if (strncmp(name, str, len) == 0 && name[len] == '\0') {
+            pthread_mutex_unlock(&symbols_lock);
+            return sym;
+        }
+    }
+
+    if (symbols.len == symbols.cap) {
+        symbols.cap = symbols.cap == 0 ? 64 : symbols.cap * 2;
+        const char **names = allocate(symbols.cap * sizeof(char*));
+        if (symbols.len > 0) {
+            memcpy(names, symbols.names, symbols.len * sizeof(char*));
+        }
+        __atomic_store_n(&symbols.names, names, __ATOMIC_RELEASE);
+    }
+    char *name = allocate(len+1);
+    memcpy(name, str, len);
+    name[len] = '\0';
+    symbol sym = symbols.len;
+    symbols.names[sym] = name;
+    symbols.slots[h & (symbols.slot_cap-1)] = sym;
+    __atomic_store_n(&symbols.len, sym + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&symbols_lock);
+    return sym;
+}
+
+const char *symbol_name(symbol sym) {
+    return __atomic_load_n(&symbols.names, __ATOMIC_ACQUIRE)[sym];
+}
+
+// how many names have been interned, which other threads may be adding to
+size_t symbol_count(void) {
+    return __atomic_load_n(&symbols.len, __ATOMIC_ACQUIRE);
+}
+
+// A variable is a symbol plus a generation number. Names coming from the
+// source have generation 0; every binder copied out of a definition or
+// substituted argument gets a fresh generation, so binders never clash and
+// capture-avoidance is an integer compare.
+typedef struct {
+    symbol name;
+    uint32_t gen;
+} variable;
+
+#define GEN_BLOCK 4096
+
+uint32_t generation = 0;    // the last generation handed to a thread
+
+// the block of generations this thread hands out, taken from `generation` a
+// block at a time so threads do not contend for every binder
+_Thread_local uint32_t gen_next = 0;
+_Thread_local uint32_t gen_end = 0;
+
+variable fresh(symbol name) {
+    if (gen_next == gen_end) {
+        uint32_t last = __atomic_fetch_add(&generation, GEN_BLOCK,
+                                           __ATOMIC_RELAXED);
+        if (last > UINT32_MAX - GEN_BLOCK) {
+            fprintf(stderr, "ERROR: out of fresh variable generations\n");
+            exit(1);
+        }
+        gen_next = last;
+        gen_end = last + GEN_BLOCK;
+    }
+    variable var = {name, ++gen_next};
+    stats.renames++;
+    return var;
+}
+
+bool var_eq(variable a, variable b) {
+    return a.name == b.name && a.gen == b.gen;
+}
 
 struct term;
+struct thunk;
 
 typedef struct {
-    char* arg;
+    variable arg;
     struct term* term;
 } abstraction;
 
 typedef struct {
-    struct term* left;
-    struct term* right;
-} application;
+    struct term* left;
+    struct term* right;
+} application;
+
+typedef enum {
+    TYPE_ABSTRACTION,
+    TYPE_APPLICATION,
+    TYPE_VARIABLE,
+    TYPE_SHARED,        // reference to a call-by-need thunk
+    TYPE_NATIVE,        // a numeral, boolean or arithmetic combinator
+} term_type;
+
+// What a definition is recognised as with native numerals enabled. A numeral
+// is held as a machine integer; false is the numeral 0, which has the same
+// shape. The combinators keep the name of their definition, so they can be
+// unfolded again when they meet something that is not a native number.
+typedef enum {
+    NATIVE_UNKNOWN = 0, // not looked at yet
+    NATIVE_NONE,
+    NATIVE_NUMBER,
+    NATIVE_TRUE,
+    NATIVE_SUCC,
+    NATIVE_ADD,
+    NATIVE_MUL,
+    NATIVE_POW,
+} native_kind;
+
+typedef struct {
+    native_kind kind;
+    symbol name;        // the definition of a combinator
+    uint64_t number;
+} native;
+
+typedef union {
+    abstraction abstraction;
+    application application;
+    variable    var;
+    struct thunk *shared;
+    native      native;
+} term_val;
+
+typedef struct term {
+    term_type type;
+    uint32_t origin;    // the profile node of the unfolding that made it
+    term_val value;
+} term;
+
+// Growable stacks, used for the work lists that replace recursion so the
+// depth of a term is only limited by the heap.
+#define STACK(type)                             \
+    struct {                                    \
+        type *items;                            \
+        size_t len;                             \
+        size_t cap;                             \
+    }
+
+#define PUSH(stack, item)                                               \
+    do {                                                                \
+        if ((stack).len == (stack).cap) {                               \
+            (stack).cap = (stack).cap == 0 ? 64 : (stack).cap * 2;      \
+            (stack).items = reallocate((stack).items,                   \
+                                       (stack).cap * sizeof(*(stack).items)); \
+        }                                                               \
+        (stack).items[(stack).len++] = (item);                          \
+    } while (0)
+
+#define POP(stack) ((stack).items[--(stack).len])
+#define TOP(stack) ((stack).items[(stack).len-1])
+
+// Terms are allocated from a pool of fixed-size nodes: blocks are carved out
+// with a bump pointer and freed nodes go on a free list, threaded through
+// their left child. Every node has exactly one owner (terms are trees), so a
+// subterm can be handed back as soon as the evaluator drops it.
+#define POOL_MIN_BLOCK 1024
+#define POOL_MAX_BLOCK (1 << 20)
+
+typedef struct pool_block {
+    struct pool_block *next;
+    size_t used;
+    size_t cap;
+    term nodes[];
+} pool_block;
+
+// Thunks and the cells and environments of the machines come from pools of
+// fixed-size slots made the same way, and the argument arrays of neutral
+// cells are chained together, so all of them go with the term pool they
+// were made in.
+typedef struct slab_block {
+    struct slab_block *next;
+    size_t used;
+    size_t cap;
+    max_align_t slots[];
+} slab_block;
+
+typedef struct {
+    slab_block *blocks;
+    void *free;         // freed slots, each holding the next one
+} slab;
+
+typedef struct tracked {
+    struct tracked *prev;
+    struct tracked *next;
+    max_align_t items[];
+} tracked;
+
+// Each thread has a pool of its own. A node goes back on the free list of
+// whichever thread frees it, so a thread's live count can go below zero.
+typedef struct {
+    pool_block *blocks;
+    term *free;
+    ptrdiff_t live;
+    ptrdiff_t peak;
+    slab thunks;
+    slab cells;
+    slab envs;
+    tracked *arrays;    // argument arrays, most recent first
+} term_pool;
+
+_Thread_local term_pool pool = {0};
+
+// a slot of `size` bytes from `s`
+void *slab_alloc(slab *s, size_t size) {
+    void *slot = s->free;
+    if (slot != NULL) {
+        s->free = *(void**)slot;
+        return slot;
+    }
+    slab_block *block = s->blocks;
+    size_t words = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t);
+    if (block == NULL || block->used + words > block->cap) {
+        size_t cap = block == NULL ? POOL_MIN_BLOCK : block->cap * 2;
+        if (cap > POOL_MAX_BLOCK) cap = POOL_MAX_BLOCK;
+        slab_block *new = allocate(sizeof(slab_block)
+                                   + cap * sizeof(max_align_t));
+        new->next = block;
+        new->used = 0;
+        new->cap  = cap;
+        s->blocks = block = new;
+    }
+    slot = &block->slots[block->used];
+    block->used += words;
+    return slot;
+}
+
+void slab_free(slab *s, void *slot) {
+    *(void**)slot = s->free;
+    s->free = slot;
+}
+
+void slab_release(slab *s) {
+    while (s->blocks != NULL) {
+        slab_block *next = s->blocks->next;
+        free(s->blocks);
+        s->blocks = next;
+    }
+    s->free = NULL;
+}
+
+// resizes an array of the pool, NULL for a new one, to `size` bytes
+void *tracked_resize(void *items, size_t size) {
+    tracked *t = NULL;
+    if (items != NULL) {
+        t = (tracked*)((char*)items - offsetof(tracked, items));
+        if (t->prev != NULL) t->prev->next = t->next; else pool.arrays = t->next;
+        if (t->next != NULL) t->next->prev = t->prev;
+    }
+    t = reallocate(t, sizeof(tracked) + size);
+    t->prev = NULL;
+    t->next = pool.arrays;
+    if (t->next != NULL) t->next->prev = t;
+    pool.arrays = t;
+    return t->items;
+}
+
+void tracked_free(void *items) {
+    if (items == NULL) return;
+    tracked *t = (tracked*)((char*)items - offsetof(tracked, items));
+    if (t->prev != NULL) t->prev->next = t->next; else pool.arrays = t->next;
+    if (t->next != NULL) t->next->prev = t->prev;
+    free(t);
+}
+
+// A thunk is an argument shared between all occurrences of its variable under
+// call-by-need. It is reduced in place, so every reference sees the result.
+// Open thunks were created under a binder and may mention bound variables:
+// copying a term duplicates them instead of sharing, and the stamps make sure
+// each one is visited once per traversal however many references it has.
+typedef struct thunk {
+    struct term *term;
+    size_t refs;
+    size_t visit;       // stamp of the last traversal that descended into it
+    size_t copied;      // stamp of the clone that produced `copy`
+    struct thunk *copy;
+    bool open;
+    bool normal;        // term is in normal form
+} thunk;
+
+_Thread_local size_t stamp = 0;
+
+thunk *new_thunk(struct term *term, size_t refs, bool open) {
+    thunk *th = slab_alloc(&pool.thunks, sizeof(thunk));
+    WORK(allocations);
+    th->term   = term;
+    th->refs   = refs;
+    th->visit  = 0;
+    th->copied = 0;
+    th->copy   = NULL;
+    th->open   = open;
+    th->normal = false;
+    return th;
+}
+
+void release(struct term *tm);
+
+// drops one reference to a thunk
+void drop(thunk *th) {
+    if (--th->refs == 0) {
+        release(th->term);
+        slab_free(&pool.thunks, th);
+    }
+}
+
+typedef STACK(struct term*) term_stack;
+
+// the value behind a chain of thunk references
+term *deref(term *tm) {
+    while (tm->type == TYPE_SHARED) tm = tm->value.shared->term;
+    return tm;
+}
+
+// the node of the profile work is charged to, which new terms come from; it
+// is read by new_term on every thread, so each has its own
+_Thread_local uint32_t profile_at = 0;
+
+term *new_term(void) {
+    term *tm = pool.free;
+    if (tm != NULL) {
+        pool.free = tm->value.application.left;
+    } else {
+        pool_block *block = pool.blocks;
+        if (block == NULL || block->used == block->cap) {
+            size_t cap = block == NULL ? POOL_MIN_BLOCK : block->cap * 2;
+            if (cap > POOL_MAX_BLOCK) cap = POOL_MAX_BLOCK;
+            pool_block *new = allocate(sizeof(pool_block) + cap * sizeof(term));
+            new->next = block;
+            new->used = 0;
+            new->cap  = cap;
+            pool.blocks = block = new;
+        }
+        tm = &block->nodes[block->used++];
+    }
+    if (++pool.live > pool.peak) pool.peak = pool.live;
+    WORK(allocations);
+    tm->origin = profile_at;
+    return tm;
+}
+
+void free_term(term *tm) {
+    tm->value.application.left = pool.free;
+    pool.free = tm;
+    pool.live--;
+}
+
+// Gives the terms made from here on a pool of their own, until pool_leave
+// frees it with whatever terms, thunks and machine cells are left in it. The
+// server answers each query in one, so what a query it abandons halfway
+// made is freed too.
+term_pool pool_enter(void) {
+    term_pool outer = pool;
+    pool = (term_pool){NULL, NULL, outer.live, outer.peak, {NULL, NULL},
+                       {NULL, NULL}, {NULL, NULL}, NULL};
+    return outer;
+}
+
+void pool_leave(term_pool outer) {
+    while (pool.blocks != NULL) {
+        pool_block *next = pool.blocks->next;
+        free(pool.blocks);
+        pool.blocks = next;
+    }
+    slab_release(&pool.thunks);
+    slab_release(&pool.cells);
+    slab_release(&pool.envs);
+    while (pool.arrays != NULL) tracked_free(pool.arrays->items);
+    if (pool.peak > outer.peak) outer.peak = pool.peak;
+    pool = outer;
+}
+
+_Thread_local term_stack release_todo = {0};
+
+// returns a whole subtree to the pool
+void release(term *tm) {
+    size_t base = release_todo.len;
+    PUSH(release_todo, tm);
+    while (release_todo.len > base) {
+        tm = POP(release_todo);
+        switch (tm->type) {
+        case TYPE_ABSTRACTION:
+            PUSH(release_todo, tm->value.abstraction.term);
+            break;
+        case TYPE_APPLICATION:
+            PUSH(release_todo, tm->value.application.left);
+            PUSH(release_todo, tm->value.application.right);
+            break;
+        case TYPE_VARIABLE:
+        case TYPE_NATIVE:
+            break;
+        case TYPE_SHARED: {
+            thunk *th = tm->value.shared;
+            if (--th->refs == 0) {
+                PUSH(release_todo, th->term);
+                slab_free(&pool.thunks, th);
+            }
+            break;
+        }}
+        free_term(tm);
+    }
+}
+
+typedef STACK(symbol) symbol_stack;
+
+// With --profile, strict evaluation charges its work to definitions. Each
+// unfolding is a node in a tree rooted at the entry, under the node of the
+// name it replaced, and every term remembers the node it was made by. A beta
+// reduction, and the copying of its argument, is charged to the node of the
+// abstraction it consumes. The counters and the clock are read whenever the
+// work moves to another node, so nothing is counted twice or sampled.
+#define NO_NODE UINT32_MAX
+
+typedef struct {
+    symbol name;
+    uint32_t parent;
+    uint32_t child;         // the first one, or NO_NODE
+    uint32_t sibling;       // the next child of the same parent, or NO_NODE
+    uint64_t calls;         // unfoldings, kept normal forms included
+    uint64_t betas;
+    uint64_t clone_nodes;
+    double seconds;
+} profile_node;
+
+STACK(profile_node) profile = {0};
+const char *profile_path = NULL;    // file to write folded stacks to
+bool profile_running = false;
+
+// the counters when they were last charged to a node
+_Thread_local struct {
+    uint64_t betas;
+    uint64_t clone_nodes;
+    double seconds;
+} profile_mark;
+
+// charges the work since the last call to the current node, then moves to
+// `node`
+void profile_switch(uint32_t node) {
+    profile_node *at = &profile.items[profile_at];
+    double now = seconds();
+    at->betas += stats.betas - profile_mark.betas;
+    at->clone_nodes += stats.clone_nodes - profile_mark.clone_nodes;
+    at->seconds += now - profile_mark.seconds;
+    profile_mark.betas = stats.betas;
+    profile_mark.clone_nodes = stats.clone_nodes;
+    profile_mark.seconds = now;
+    profile_at = node;
+}
+
+uint32_t profile_add(symbol name, uint32_t parent) {
+    PUSH(profile, ((profile_node){name, parent, NO_NODE, NO_NODE, 0, 0, 0,
+                                  0}));
+    return profile.len - 1;
+}
+
+// starts charging work to the root, evaluating `entry`
+void profile_start(symbol entry) {
+    if (profile.len == 0) profile_add(entry, NO_NODE);
+    profile.items[0].calls++;
+    profile_at = 0;
+    profile_running = true;
+    profile_mark.betas = stats.betas;
+    profile_mark.clone_nodes = stats.clone_nodes;
+    profile_mark.seconds = seconds();
+}
+
+// charges what is left once evaluation is over
+void profile_stop(void) {
+    if (!profile_running) return;
+    profile_switch(profile_at);
+    profile_running = false;
+}
+
+// the node of `name` unfolded under `parent`
+uint32_t profile_child(uint32_t parent, symbol name) {
+    uint32_t node = profile.items[parent].child;
+    while (node != NO_NODE && profile.items[node].name != name) {
+        node = profile.items[node].sibling;
+    }
+    if (node == NO_NODE) {
+        node = profile_add(name, parent);
+        profile.items[node].sibling = profile.items[parent].child;
+        profile.items[parent].child = node;
+    }
+    return node;
+}
+
+// the node of `name` unfolded under `parent`, counted as a call
+uint32_t profile_call(uint32_t parent, symbol name) {
+    uint32_t node = profile_child(parent, name);
+    profile.items[node].calls++;
+    return node;
+}
+
+// the node on the same path below `to` as `node` is below `from`, or `to`
+// itself if `node` is not below `from`
+uint32_t profile_move(uint32_t node, uint32_t from, uint32_t to) {
+    static symbol_stack path = {0};
+    path.len = 0;
+    while (node != from && node != NO_NODE) {
+        PUSH(path, profile.items[node].name);
+        node = profile.items[node].parent;
+    }
+    if (node == NO_NODE) return to;
+    while (path.len > 0) to = profile_child(to, POP(path));
+    return to;
+}
+
+// the work of a definition over all the paths it was called on
+typedef struct {
+    symbol name;
+    uint64_t calls;
+    uint64_t betas;
+    uint64_t clone_nodes;
+    double seconds;
+    double total_seconds;   // with the definitions it called
+} profile_entry;
+
+int by_betas(const void *a, const void *b) {
+    const profile_entry *x = a, *y = b;
+    if (x->betas != y->betas) return x->betas < y->betas ? 1 : -1;
+    if (x->seconds != y->seconds) return x->seconds < y->seconds ? 1 : -1;
+    return strcmp(symbol_name(x->name), symbol_name(y->name));
+}
+
+// Writes each path of the tree with the beta reductions done on it to
+// `profile_path`, one `main;f;g count` line each as flame graph tools read
+// them, and prints the work of each definition to stderr, most first.
+void write_profile(void) {
+    if (profile.len == 0) return;
+    profile_stop();
+    FILE *file = fopen(profile_path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: could not write the profile to %s: %s"
+                " (ERRNO %d)\n", profile_path, strerror(errno), errno);
+    }
+    symbol_stack path = {0};
+    for (uint32_t i = 0; file != NULL && i < profile.len; i++) {
+        if (profile.items[i].betas == 0) continue;
+        path.len = 0;
+        for (uint32_t n = i; n != NO_NODE; n = profile.items[n].parent) {
+            PUSH(path, profile.items[n].name);
+        }
+        while (path.len > 0) {
+            symbol name = POP(path);
+            fprintf(file, "%s%c", symbol_name(name), path.len > 0 ? ';' : ' ');
+        }
+        fprintf(file, "%llu\n", (unsigned long long)profile.items[i].betas);
+    }
+    if (file != NULL) fclose(file);
+    free(path.items);
+
+    // children come after their parent, so their time is added up first
+    double *total = allocate(profile.len * sizeof(double));
+    for (uint32_t i = 0; i < profile.len; i++) {
+        total[i] = profile.items[i].seconds;
+    }
+    for (uint32_t i = profile.len; i-- > 1;) {
+        total[profile.items[i].parent] += total[i];
+    }
+    uint32_t *entry_of = allocate(symbols.len * sizeof(uint32_t));
+    for (size_t i = 0; i < symbols.len; i++) entry_of[i] = UINT32_MAX;
+    STACK(profile_entry) entries = {0};
+    for (uint32_t i = 0; i < profile.len; i++) {
+        const profile_node *node = &profile.items[i];
+        if (entry_of[node->name] == UINT32_MAX) {
+            entry_of[node->name] = entries.len;
+            PUSH(entries, ((profile_entry){node->name, 0, 0, 0, 0, 0}));
+        }
+        profile_entry *e = &entries.items[entry_of[node->name]];
+        e->calls += node->calls;
+        e->betas += node->betas;
+        e->clone_nodes += node->clone_nodes;
+        e->seconds += node->seconds;
+        // a definition called within itself is only counted at the top
+        uint32_t up = node->parent;
+        while (up != NO_NODE && profile.items[up].name != node->name) {
+            up = profile.items[up].parent;
+        }
+        if (up == NO_NODE) e->total_seconds += total[i];
+    }
+    qsort(entries.items, entries.len, sizeof(profile_entry), by_betas);
+    fprintf(stderr, "%-20s %12s %14s %14s %10s %10s\n", "definition",
+            "calls", "betas", "clone_nodes", "self_s", "total_s");
+    for (size_t i = 0; i < entries.len; i++) {
+        const profile_entry *e = &entries.items[i];
+        fprintf(stderr, "%-20s %12llu %14llu %14llu %10.6f %10.6f\n",
+                symbol_name(e->name), (unsigned long long)e->calls,
+                (unsigned long long)e->betas,
+                (unsigned long long)e->clone_nodes, e->seconds,
+                e->total_seconds);
+    }
+    free(total);
+    free(entry_of);
+    free(entries.items);
+}
+
+// The terms that are kept rather than reduced, the definitions and the normal
+// forms strict evaluation keeps of them, are stored packed: the nodes in
+// prefix order in parallel arrays, numbered with 32 bits, at 9 bytes a node
+// where a term takes 24. A bound variable is held as its de Bruijn index, so
+// a copy is built in one pass along the arrays without looking names up.
+// Trees are built from them to be reduced, compiled or printed.
+
+typedef enum {
+    PACKED_ABSTRACTION,     // its body is the next node
+    PACKED_APPLICATION,     // its function is the next node
+    PACKED_BOUND,
+    PACKED_FREE,
+} packed_tag;
+
+#define PACKED_MAX_NODES UINT32_MAX
+
+typedef struct packed {
+    uint32_t len;
+    uint32_t *a;        // the name of a binder or free variable, the de
+                        // Bruijn index of a bound one
+    uint32_t *b;        // the generation of a binder or free variable, the
+                        // node where the argument of an application starts
+    uint8_t *tags;
+    uint32_t *origins;  // with --profile, the profile node that made each
+                        // one, below the unfolding `base`; otherwise NULL
+    uint32_t base;
+} packed;
+
+// a node still to be packed, under the first `depth` binders of the scope
+typedef struct {
+    const term *src;
+    size_t depth;
+    uint32_t app;       // the application it is the argument of, if any
+} pack_item;
+
+// copies the arrays of a packed term into one allocation
+packed *new_packed(size_t len, const uint32_t *a, const uint32_t *b,
+                   const uint8_t *tags, const uint32_t *origins,
+                   uint32_t base) {
+    size_t words = origins != NULL ? 3 : 2;
+    packed *p = allocate(sizeof(packed)
+                         + len * (words * sizeof(uint32_t) + 1));
+    p->len = len;
+    p->a = (uint32_t*)(p + 1);
+    p->b = p->a + len;
+    p->origins = origins != NULL ? p->b + len : NULL;
+    p->base = base;
+    p->tags = (uint8_t*)(p->b + (words - 1) * len);
+    memcpy(p->a, a, len * sizeof(uint32_t));
+    memcpy(p->b, b, len * sizeof(uint32_t));
+    if (origins != NULL) memcpy(p->origins, origins, len * sizeof(uint32_t));
+    memcpy(p->tags, tags, len);
+    return p;
+}
+
+// Packs a term made of abstractions, applications and variables. Unless
+// `base` is NO_NODE, it keeps where each node came from, as a normal form
+// made by that unfolding in the profile.
+packed *pack(const term *tm, uint32_t base) {
+    static _Thread_local STACK(pack_item) todo = {0};
+    static _Thread_local STACK(variable) scope = {0};
+    static _Thread_local STACK(uint32_t) a = {0};
+    static _Thread_local STACK(uint32_t) b = {0};
+    static _Thread_local STACK(uint8_t) tags = {0};
+    static _Thread_local STACK(uint32_t) origins = {0};
+    a.len = b.len = tags.len = origins.len = 0;
+    todo.len = 0;
+    PUSH(todo, ((pack_item){tm, 0, NO_NODE}));
+    while (todo.len > 0) {
+        pack_item item = POP(todo);
+        if (tags.len == PACKED_MAX_NODES) {
+            fprintf(error_out(), "ERROR: a term is too big to keep\n");
+            give_up();
+        }
+        uint32_t node = tags.len;
+        if (item.app != NO_NODE) b.items[item.app] = node;
+        scope.len = item.depth;
+        tm = item.src;
+        if (base != NO_NODE) PUSH(origins, tm->origin);
+        switch (tm->type) {
+        case TYPE_ABSTRACTION: {
+            variable arg = tm->value.abstraction.arg;
+            PUSH(tags, PACKED_ABSTRACTION);
+            PUSH(a, arg.name);
+            PUSH(b, arg.gen);
+            PUSH(scope, arg);
+            PUSH(todo, ((pack_item){tm->value.abstraction.term, scope.len,
+                                    NO_NODE}));
+            break;
+        } case TYPE_APPLICATION:
+            PUSH(tags, PACKED_APPLICATION);
+            PUSH(a, 0);
+            PUSH(b, 0);
+            PUSH(todo, ((pack_item){tm->value.application.right, scope.len,
+                                    node}));
+            PUSH(todo, ((pack_item){tm->value.application.left, scope.len,
+                                    NO_NODE}));
+            break;
+        case TYPE_VARIABLE: {
+            variable var = tm->value.var;
+            size_t i = scope.len;
+            while (i > 0 && !var_eq(scope.items[i-1], var)) i--;
+            if (i > 0) {
+                PUSH(tags, PACKED_BOUND);
+                PUSH(a, scope.len - i);
+                PUSH(b, 0);
+            } else {
+                PUSH(tags, PACKED_FREE);
+                PUSH(a, var.name);
+                PUSH(b, var.gen);
+            }
+            break;
+        } default:
+            // only parsed terms and their normal forms are kept
+            assert(false);
+            break;
+        }
+    }
+
+    return new_packed(tags.len, a.items, b.items, tags.items,
+                      base != NO_NODE ? origins.items : NULL, base);
+}
+
+// where an unpacked node goes, under the first `depth` binders of the scope
+typedef struct {
+    term **dst;
+    size_t depth;
+} unpack_item;
+
+// Builds the term `p` holds. With `renamed`, every binder gets a fresh
+// generation, as clone would give it, and it counts as a clone. A kept
+// normal form is made again by the current unfolding in the profile.
+term *unpack(const packed *p, bool renamed) {
+    static _Thread_local STACK(unpack_item) todo = {0};
+    static _Thread_local STACK(variable) scope = {0};
+    uint32_t from = NO_NODE;
+    uint32_t origin = profile_at;
+    term *root;
+    todo.len = 0;
+    PUSH(todo, ((unpack_item){&root, 0}));
+    for (uint32_t i = 0; i < p->len; i++) {
+        unpack_item item = POP(todo);
+        scope.len = item.depth;
+        term *tm = new_term();
+        *item.dst = tm;
+        if (p->origins != NULL) {
+            // runs of nodes mostly come from the same place
+            if (p->origins[i] != from) {
+                from = p->origins[i];
+                origin = profile_move(from, p->base, profile_at);
+            }
+            tm->origin = origin;
+        }
+        switch (p->tags[i]) {
+        case PACKED_ABSTRACTION: {
+            variable arg = {p->a[i], p->b[i]};
+            if (renamed) arg = fresh(arg.name);
+            tm->type = TYPE_ABSTRACTION;
+            tm->value.abstraction.arg = arg;
+            PUSH(scope, arg);
+            PUSH(todo, ((unpack_item){&tm->value.abstraction.term,
+                                      scope.len}));
+            break;
+        } case PACKED_APPLICATION:
+            tm->type = TYPE_APPLICATION;
+            PUSH(todo, ((unpack_item){&tm->value.application.right,
+                                      scope.len}));
+            PUSH(todo, ((unpack_item){&tm->value.application.left,
+                                      scope.len}));
+            break;
+        case PACKED_BOUND:
+            tm->type = TYPE_VARIABLE;
+            tm->value.var = scope.items[scope.len - 1 - p->a[i]];
+            break;
+        case PACKED_FREE:
+            tm->type = TYPE_VARIABLE;
+            tm->value.var = (variable){p->a[i], p->b[i]};
+            break;
+        }
+    }
+    if (renamed) {
+        stats.clones++;
+        stats.clone_nodes += p->len;
+    }
+    return root;
+}
+
+// appends the names `p` uses without binding them, as often as it does
+void packed_names(const packed *p, symbol_stack *names) {
+    for (uint32_t i = 0; i < p->len; i++) {
+        if (p->tags[i] == PACKED_FREE) PUSH(*names, p->a[i]);
+    }
+}
+
+// Printing. Output is gathered in a buffer and written in pieces of about
+// PRINT_CHUNK bytes, so a big normal form costs a few writes rather than a
+// call for every name and parenthesis.
+#define PRINT_CHUNK (1 << 20)
+
+size_t print_depth = 0;     // the layers of a result printed, 0 for all
+
+// whether the nodes `level` layers below the root are printed, rather than
+// left out as `...`
+bool printed_layer(size_t level) {
+    return print_depth == 0 || level < print_depth;
+}
+
+_Thread_local STACK(char) print_buffer = {0};
+
+void print_bytes(const char *bytes, size_t len) {
+    if (print_buffer.len + len > print_buffer.cap) {
+        size_t cap = print_buffer.cap == 0 ? 64 : print_buffer.cap;
+        while (cap < print_buffer.len + len) cap *= 2;
+        print_buffer.items = reallocate(print_buffer.items, cap);
+        print_buffer.cap = cap;
+    }
+    memcpy(print_buffer.items + print_buffer.len, bytes, len);
+    print_buffer.len += len;
+}
+
+void print_text(const char *text) {
+    print_bytes(text, strlen(text));
+}
+
+void print_flush(FILE *out) {
+    if (print_buffer.len > 0) {
+        fwrite(print_buffer.items, 1, print_buffer.len, out);
+    }
+    print_buffer.len = 0;
+}
+
+// Binders are printed with their own name, unless a binder around them is
+// printed the same or a free name is spelled like it: then with the first
+// of `x1`, `x2`, ... that is neither. Generations never show, and the output
+// parses back to the same term.
+typedef struct {
+    variable var;
+    symbol printed;     // NO_SYMBOL if the binder is not named
+    uint32_t suffix;    // 0 if it is printed with its own name
+    uint32_t hidden;    // the binder of the same variable it hides
+} print_binder;
+
+#define NO_BINDER UINT32_MAX
+
+// where the innermost binder of a variable is on the scope
+typedef struct {
+    variable var;
+    uint32_t binder;    // NO_BINDER once it is left
+    uint32_t stamp;
+} print_slot;
+
+typedef struct {
+    STACK(print_binder) scope;
+    print_slot *slots;      // open addressing, another stamp marks it empty
+    size_t slot_cap;        // always a power of two
+    size_t slot_len;
+    uint32_t stamp;
+    uint32_t *uses;         // by symbol: the binders in scope printed as it,
+                            // and one more if it is a free name
+    uint32_t *next;         // by symbol: the first suffix worth trying
+    size_t symbol_cap;
+    symbol_stack free_names;
+} printer_state;
+
+_Thread_local printer_state printer = {0};
+
+size_t hash_var(variable var) {
+    uint64_t key = (uint64_t)var.name << 32 | var.gen;
+    return (size_t)(key * 0x9E3779B97F4A7C15ULL >> 17);
+}
+
+void printer_reserve(symbol sym) {
+    if (sym < printer.symbol_cap) return;
+    size_t old = printer.symbol_cap;
+    size_t cap = old == 0 ? 64 : old;
+    while (cap <= sym) cap *= 2;
+    printer.uses = reallocate(printer.uses, cap * sizeof(uint32_t));
+    printer.next = reallocate(printer.next, cap * sizeof(uint32_t));
+    memset(printer.uses + old, 0, (cap - old) * sizeof(uint32_t));
+    memset(printer.next + old, 0, (cap - old) * sizeof(uint32_t));
+    printer.symbol_cap = cap;
+}
+
+// the slot of `var`, claimed for it if it has none
+print_slot *printer_slot(variable var) {
+    if (2 * (printer.slot_len + 1) > printer.slot_cap) {
+        size_t cap = printer.slot_cap == 0 ? 64 : printer.slot_cap * 2;
+        print_slot *slots = allocate(cap * sizeof(print_slot));
+        for (size_t i = 0; i < cap; i++) slots[i].stamp = 0;
+        for (size_t i = 0; i < printer.slot_cap; i++) {
+            print_slot s = printer.slots[i];
+            if (s.stamp != printer.stamp) continue;
+            size_t h = hash_var(s.var);
+            while (slots[h & (cap-1)].stamp == printer.stamp) h++;
+            slots[h & (cap-1)] = s;
+        }
+        free(printer.slots);
+        printer.slots = slots;
+        printer.slot_cap = cap;
+    }
+    for (size_t h = hash_var(var);; h++) {
+        print_slot *s = &printer.slots[h & (printer.slot_cap-1)];
+        if (s->stamp != printer.stamp) {
+            *s = (print_slot){var, NO_BINDER, printer.stamp};
+            printer.slot_len++;
+            return s;
+        }
+        if (var_eq(s->var, var)) return s;
+    }
+}
+
+// the symbol spelled like `name` followed by `suffix`
+symbol suffixed(symbol name, uint32_t suffix) {
+    static _Thread_local STACK(char) text = {0};
+    text.len = 0;
+    for (const char *c = symbol_name(name); *c != '\0'; c++) PUSH(text, *c);
+    char digits[16];
+    int len = snprintf(digits, sizeof(digits), "%u", suffix);
+    for (int i = 0; i < len; i++) PUSH(text, digits[i]);
+    return intern(text.items, text.len);
+}
+
+// a term to print, and how many layers below the root it is
+typedef struct {
+    const term *tm;
+    size_t level;
+} print_item;
+
+// Readies the printer for `tm`. With `named`, the names free in the layers
+// that are printed are taken; a name with generation 0 is taken to be free,
+// which at worst numbers a binder that did not need it.
+void printer_start(const term *tm, bool named) {
+    static _Thread_local STACK(print_item) todo = {0};
+    if (++printer.stamp == 0) {
+        for (size_t i = 0; i < printer.slot_cap; i++) {
+            printer.slots[i].stamp = 0;
+        }
+        printer.stamp = 1;
+    }
+    printer.slot_len = 0;
+    if (!named) return;
+    PUSH(todo, ((print_item){tm, 0}));
+    while (todo.len > 0) {
+        print_item item = POP(todo);
+        if (!printed_layer(item.level)) continue;
+        tm = item.tm;
+        size_t below = item.level + 1;
+        symbol name = NO_SYMBOL;
+        switch (tm->type) {
+        case TYPE_ABSTRACTION:
+            PUSH(todo, ((print_item){tm->value.abstraction.term, below}));
+            continue;
+        case TYPE_APPLICATION:
+            PUSH(todo, ((print_item){tm->value.application.right, below}));
+            PUSH(todo, ((print_item){tm->value.application.left, below}));
+            continue;
+        case TYPE_SHARED:
+            PUSH(todo, ((print_item){tm->value.shared->term, item.level}));
+            continue;
+        case TYPE_VARIABLE:
+            if (tm->value.var.gen != 0) continue;
+            name = tm->value.var.name;
+            break;
+        case TYPE_NATIVE:
+            if (tm->value.native.kind == NATIVE_NUMBER) continue;
+            name = tm->value.native.name;
+            break;
+        }
+        printer_reserve(name);
+        if (printer.uses[name] == 0) {
+            printer.uses[name] = 1;
+            PUSH(printer.free_names, name);
+        }
+    }
+}
+
+// puts the binder of `var` in scope, giving it a name if `named`
+void printer_enter(variable var, bool named) {
+    print_binder b = {var, NO_SYMBOL, 0, NO_BINDER};
+    if (named) {
+        printer_reserve(var.name);
+        b.printed = var.name;
+        if (printer.uses[var.name] > 0) {
+            uint32_t k = printer.next[var.name] == 0
+                ? 1 : printer.next[var.name];
+            for (;; k++) {
+                b.printed = suffixed(var.name, k);
+                printer_reserve(b.printed);
+                if (printer.uses[b.printed] == 0) break;
+            }
+            b.suffix = k;
+            printer.next[var.name] = k + 1;
+        }
+        printer.uses[b.printed]++;
+    }
+    print_slot *s = printer_slot(var);
+    b.hidden = s->binder;
+    s->binder = printer.scope.len;
+    PUSH(printer.scope, b);
+}
+
+void printer_leave(void) {
+    print_binder b = POP(printer.scope);
+    printer_slot(b.var)->binder = b.hidden;
+    if (b.printed == NO_SYMBOL) return;
+    printer.uses[b.printed]--;
+    if (b.suffix != 0 && b.suffix < printer.next[b.var.name]) {
+        printer.next[b.var.name] = b.suffix;
+    }
+}
+
+// the binder `var` refers to, or NULL if it is free
+const print_binder *printer_find(variable var) {
+    uint32_t b = printer_slot(var)->binder;
+    return b == NO_BINDER ? NULL : &printer.scope.items[b];
+}
+
+// gives back what the printer took, also when a print is abandoned
+void printer_finish(void) {
+    while (printer.scope.len > 0) printer_leave();
+    while (printer.free_names.len > 0) {
+        symbol name = POP(printer.free_names);
+        printer.uses[name] = 0;
+    }
+}
+
+// a pending piece of output: a fixed string, a term and its layer, or
+// neither where the scope of a binder ends
+typedef struct {
+    const char *text;
+    const term *term;
+    size_t level;
+} dump_item;
+
+void dump_(FILE *out, const term *term) {
+    static _Thread_local STACK(dump_item) todo = {0};
+    printer_start(term, true);
+    PUSH(todo, ((dump_item){NULL, term, 0}));
+    while (todo.len > 0) {
+        dump_item item = POP(todo);
+        if (item.text != NULL) {
+            print_text(item.text);
+            continue;
+        }
+        if (item.term == NULL) {
+            printer_leave();
+            continue;
+        }
+        if (print_buffer.len >= PRINT_CHUNK) print_flush(out);
+        if (!printed_layer(item.level)) {
+            print_text("...");
+            continue;
+        }
+        term = item.term;
+        size_t below = item.level + 1;
+        switch (term->type) {
+        case TYPE_ABSTRACTION:
+            printer_enter(term->value.abstraction.arg, true);
+            print_text("\\");
+            print_text(symbol_name(TOP(printer.scope).printed));
+            print_text(".");
+            PUSH(todo, ((dump_item){NULL, NULL, 0}));
+            PUSH(todo, ((dump_item){NULL, term->value.abstraction.term,
+                                    below}));
+            break;
+        case TYPE_APPLICATION:
+            print_text("(");
+            PUSH(todo, ((dump_item){")",  NULL, 0}));
+            PUSH(todo, ((dump_item){NULL, term->value.application.right,
+                                    below}));
+            PUSH(todo, ((dump_item){")(", NULL, 0}));
+            PUSH(todo, ((dump_item){NULL, term->value.application.left,
+                                    below}));
+            break;
+        case TYPE_VARIABLE: {
+            const print_binder *b = printer_find(term->value.var);
+            symbol name = b == NULL ? term->value.var.name : b->printed;
+            print_text(symbol_name(name));
+            break;
+        }
+        case TYPE_SHARED:
+            PUSH(todo, ((dump_item){NULL, term->value.shared->term,
+                                    item.level}));
+            break;
+        case TYPE_NATIVE:
+            if (term->value.native.kind == NATIVE_NUMBER) {
+                char digits[24];
+                int len = snprintf(digits, sizeof(digits), "%llu",
+                                   (unsigned long long)
+                                   term->value.native.number);
+                print_bytes(digits, len);
+            } else {
+                print_text(symbol_name(term->value.native.name));
+            }
+            break;
+        }
+    }
+    printer_finish();
+    print_flush(out);
+}
+
+void dump(FILE *out, const term *term) {
+    dump_(out, term);
+    fprintf(out, "\n");
+}
+
+// Binary lambda calculus: an abstraction is 00 and its body, an application
+// 01 and its two sides, and a variable bound by the n-th binder around it is
+// n ones and a zero. OUTPUT_BLC writes the bits as the characters `0` and
+// `1` on a line, OUTPUT_BLC8 packs them eight to a byte, the first bit
+// highest, with the last byte filled up with zeros.
+typedef enum {
+    OUTPUT_TEXT,
+    OUTPUT_BLC,
+    OUTPUT_BLC8,
+} output_kind;
+
+output_kind output_format = OUTPUT_TEXT;   // set by --output
+
+typedef struct {
+    uint8_t byte;
+    unsigned bits;
+} blc_writer;
+
+void blc_put(blc_writer *w, bool bit) {
+    if (output_format == OUTPUT_BLC) {
+        print_bytes(bit ? "1" : "0", 1);
+        return;
+    }
+    w->byte = w->byte << 1 | bit;
+    if (++w->bits == 8) {
+        print_bytes((const char *)&w->byte, 1);
+        w->byte = 0;
+        w->bits = 0;
+    }
+}
+
+// writes `tm` as binary lambda calculus, all at once: a free variable cannot
+// be written, and abandons the output with an error
+void dump_blc(FILE *out, const term *tm) {
+    static _Thread_local STACK(const term*) todo = {0};
+    blc_writer w = {0, 0};
+    printer_start(tm, false);
+    todo.len = 0;
+    PUSH(todo, tm);
+    while (todo.len > 0) {
+        tm = POP(todo);
+        if (tm == NULL) {
+            printer_leave();
+            continue;
+        }
+        switch (tm->type) {
+        case TYPE_ABSTRACTION:
+            blc_put(&w, 0);
+            blc_put(&w, 0);
+            printer_enter(tm->value.abstraction.arg, false);
+            PUSH(todo, NULL);
+            PUSH(todo, tm->value.abstraction.term);
+            break;
+        case TYPE_APPLICATION:
+            blc_put(&w, 0);
+            blc_put(&w, 1);
+            PUSH(todo, tm->value.application.right);
+            PUSH(todo, tm->value.application.left);
+            break;
+        case TYPE_VARIABLE: {
+            const print_binder *b = printer_find(tm->value.var);
+            if (b == NULL) {
+                print_buffer.len = 0;
+                printer_finish();
+                fprintf(error_out(), "ERROR: `%s` is free in the result, "
+                        "which binary lambda calculus cannot write\n",
+                        symbol_name(tm->value.var.name));
+                give_up();
+            }
+            for (size_t i = b - printer.scope.items; i < printer.scope.len;
+                 i++) {
+                blc_put(&w, 1);
+            }
+            blc_put(&w, 0);
+            break;
+        }
+        case TYPE_SHARED:
+            PUSH(todo, tm->value.shared->term);
+            break;
+        case TYPE_NATIVE:
+            // eval_line turns them back into lambda terms for this output
+            print_buffer.len = 0;
+            printer_finish();
+            fprintf(error_out(), "ERROR: binary lambda calculus cannot "
+                    "write natives\n");
+            give_up();
+        }
+    }
+    printer_finish();
+    if (output_format == OUTPUT_BLC) {
+        print_text("\n");
+    } else if (w.bits > 0) {
+        w.byte <<= 8 - w.bits;
+        print_bytes((const char *)&w.byte, 1);
+    }
+    print_flush(out);
+}
+
+// The source is scanned once, front to back: the lexer hands out tokens that
+// point into the buffer and knows where each one starts, so nothing is ever
+// rescanned and errors can say where they are.
+typedef enum {
+    TOKEN_NAME,
+    TOKEN_LAMBDA,
+    TOKEN_DOT,
+    TOKEN_OPEN,
+    TOKEN_CLOSE,
+    TOKEN_EQUALS,
+    TOKEN_END,
+} token_kind;
+
+typedef struct {
+    token_kind kind;
+    const char *text;
+    size_t len;
+    size_t line;
+    size_t column;
+} token;
+
+#define LOOKAHEAD 3     // enough to see `main num =` coming
+
+typedef struct {
+    const char *src;
+    size_t len;
+    size_t pos;
+    size_t line;
+    size_t line_start;  // offset of the first character of `line`
+    token ahead[LOOKAHEAD];
+    size_t ahead_len;
+} lexer;
+
+void lexer_init(lexer *lx, const char *src, size_t len) {
+    lx->src = src;
+    lx->len = len;
+    lx->pos = 0;
+    lx->line = 1;
+    lx->line_start = 0;
+    lx->ahead_len = 0;
+}
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool is_name_char(char c) {
+    return !is_space(c) && c != '.' && c != '\\'
+        && c != '(' && c != ')' && c != '=';
+}
+
+// scans the next token, skipping white space and `--` comments
+token scan(lexer *lx) {
+    const char *src = lx->src;
+    for (;;) {
+        while (lx->pos < lx->len && is_space(src[lx->pos])) {
+            if (src[lx->pos] == '\n') {
+                lx->line++;
+                lx->line_start = lx->pos+1;
+            }
+            lx->pos++;
+        }
+        if (lx->pos+1 < lx->len
+            && src[lx->pos] == '-' && src[lx->pos+1] == '-') {
+            while (lx->pos < lx->len && src[lx->pos] != '\n') lx->pos++;
+            continue;
+        }
+        break;
+    }
+
+    token tok = {TOKEN_END, src + lx->pos, 1, lx->line,
+                 lx->pos - lx->line_start + 1};
+    if (lx->pos == lx->len) {
+        tok.len = 0;
+        return tok;
+    }
+    switch (src[lx->pos]) {
+    case '\\': tok.kind = TOKEN_LAMBDA; break;
+    case '.':  tok.kind = TOKEN_DOT;    break;
+    case '(':  tok.kind = TOKEN_OPEN;   break;
+    case ')':  tok.kind = TOKEN_CLOSE;  break;
+    case '=':  tok.kind = TOKEN_EQUALS; break;
+    default: {
+        size_t start = lx->pos;
+        while (lx->pos < lx->len && is_name_char(src[lx->pos])) lx->pos++;
+        tok.kind = TOKEN_NAME;
+        tok.len = lx->pos - start;
+        return tok;
+    }}
+    lx->pos++;
+    return tok;
+}
+
+// the token `i` places ahead, without consuming anything
+token peek(lexer *lx, size_t i) {
+    while (lx->ahead_len <= i) lx->ahead[lx->ahead_len++] = scan(lx);
+    return lx->ahead[i];
+}
+
+token advance(lexer *lx) {
+    token tok = peek(lx, 0);
+    lx->ahead_len--;
+    memmove(lx->ahead, lx->ahead+1, lx->ahead_len * sizeof(token));
+    return tok;
+}
+
+const char *token_names[] = {
+    [TOKEN_NAME]   = "a name",
+    [TOKEN_LAMBDA] = "`\\`",
+    [TOKEN_DOT]    = "`.`",
+    [TOKEN_OPEN]   = "`(`",
+    [TOKEN_CLOSE]  = "`)`",
+    [TOKEN_EQUALS] = "`=`",
+    [TOKEN_END]    = "the end of the input",
+};
+
+void parse_error(token tok, const char *msg) {
+    FILE *out = error_out();
+    fprintf(out, "Parse error at line %zu, column %zu: %s",
+            tok.line, tok.column, msg);
+    if (tok.kind == TOKEN_NAME) {
+        fprintf(out, ", found `%.*s`\n", (int)tok.len, tok.text);
+    } else {
+        fprintf(out, ", found %s\n", token_names[tok.kind]);
+    }
+    give_up();
+}
+
+token expect(lexer *lx, token_kind kind, const char *msg) {
+    token tok = advance(lx);
+    if (tok.kind != kind) parse_error(tok, msg);
+    return tok;
+}
+
+bool token_is(token tok, const char *text) {
+    return tok.kind == TOKEN_NAME && strlen(text) == tok.len
+        && memcmp(tok.text, text, tok.len) == 0;
+}
+
+// whether a definition `name =` or `main type =` starts here
+bool at_definition(lexer *lx) {
+    token first = peek(lx, 0);
+    if (first.kind != TOKEN_NAME) return false;
+    token_kind next = peek(lx, 1).kind;
+    return next == TOKEN_EQUALS
+        || (token_is(first, "main") && next == TOKEN_NAME
+            && peek(lx, 2).kind == TOKEN_EQUALS);
+}
+
+// an application being built left to right, or the body of a lambda
+typedef struct {
+    term *acc;          // the terms so far, applied in order; NULL if none
+    term *lambda;       // the abstraction this is the body of, or NULL
+    token open;         // the token that started it
+} parse_frame;
+
+void append(parse_frame *frame, term *tm) {
+    if (frame->acc == NULL) {
+        frame->acc = tm;
+        return;
+    }
+    term *app = new_term();
+    app->type = TYPE_APPLICATION;
+    app->value.application.left  = frame->acc;
+    app->value.application.right = tm;
+    frame->acc = app;
+}
+
+_Thread_local STACK(parse_frame) parse_stack = {0};
+
+// Parses a term: application is left associative and a lambda extends as far
+// to the right as it can. The term ends at the end of the input or where
+// the next definition starts. Open parentheses and lambdas are kept on a
+// heap stack, so nesting depth is not limited by the C stack.
+term *parse(lexer *lx) {
+    size_t base = parse_stack.len;
+    size_t depth = 0;   // open parentheses
+    PUSH(parse_stack, ((parse_frame){NULL, NULL, peek(lx, 0)}));
+
+    for (;;) {
+        token tok = peek(lx, 0);
+        bool end = tok.kind == TOKEN_END || (depth == 0 && at_definition(lx));
+        if (end || tok.kind == TOKEN_CLOSE) {
+            // the bodies of the lambdas end here
+            while (TOP(parse_stack).lambda != NULL) {
+                parse_frame frame = POP(parse_stack);
+                if (frame.acc == NULL) parse_error(tok, "expected a term");
+                frame.lambda->value.abstraction.term = frame.acc;
+                append(&TOP(parse_stack), frame.lambda);
+            }
+            if (end) {
+                if (depth > 0) {
+                    token open = TOP(parse_stack).open;
+                    fprintf(error_out(), "Parse error at line %zu, column %zu: "
+                            "`(` is never closed\n", open.line, open.column);
+                    give_up();
+                }
+                parse_frame root = POP(parse_stack);
+                if (root.acc == NULL) parse_error(tok, "expected a term");
+                assert(parse_stack.len == base);
+                return root.acc;
+            }
+            if (depth == 0) parse_error(tok, "unbalanced parentheses");
+            advance(lx);
+            parse_frame frame = POP(parse_stack);
+            depth--;
+            if (frame.acc == NULL) parse_error(tok, "expected a term");
+            append(&TOP(parse_stack), frame.acc);
+            continue;
+        }
+
+        advance(lx);
+        switch (tok.kind) {
+        case TOKEN_NAME: {
+            term *var = new_term();
+            var->type = TYPE_VARIABLE;
+            var->value.var.name = intern(tok.text, tok.len);
+            var->value.var.gen  = 0;
+            append(&TOP(parse_stack), var);
+            break;
+        } case TOKEN_OPEN:
+            depth++;
+            PUSH(parse_stack, ((parse_frame){NULL, NULL, tok}));
+            break;
+        case TOKEN_LAMBDA: {
+            token name = expect(lx, TOKEN_NAME, "expected a variable");
+            expect(lx, TOKEN_DOT, "expected `.`");
+            term *abs = new_term();
+            abs->type = TYPE_ABSTRACTION;
+            abs->value.abstraction.arg.name = intern(name.text, name.len);
+            abs->value.abstraction.arg.gen  = 0;
+            PUSH(parse_stack, ((parse_frame){NULL, abs, tok}));
+            break;
+        } default:
+            parse_error(tok, "expected a term");
+        }
+    }
+}
+
+// parses a term given as a string
+term *parse_string(const char *src) {
+    lexer lx;
+    lexer_init(&lx, src, strlen(src));
+    return parse(&lx);
+}
+
+typedef enum {
+    NONE = 0,
+    TYPE_INT,
+    TYPE_BOOL,
+} display_type;
+
+struct mterm;
+
+typedef uint32_t instr;
+
+typedef struct {
+    symbol name;
+    packed *body;           // the definition
+    term *term;             // while the line is evaluated, and its result
+    display_type type;
+    packed *normal;         // what strict evaluation made of it, or NULL
+    struct mterm *code;     // compiled for the environment machine, or NULL
+    instr *bytecode;        // compiled for the bytecode machine, or NULL
+    native native;          // what the definition is recognised as
+    bool lazy;              // `term` is normalized only as it is printed
+} line_t;
+
+// Parses the start of a definition, `name =` or `main type =`. Returns false
+// at the end of the input.
+bool parse_header(lexer *lx, symbol *sym, display_type *tp) {
+    token name = advance(lx);
+    if (name.kind == TOKEN_END) return false;
+    if (name.kind != TOKEN_NAME) parse_error(name, "expected a definition");
+
+    *tp = NONE;
+    if (token_is(name, "main") && peek(lx, 0).kind == TOKEN_NAME) {
+        // allow type specification
+        token type = advance(lx);
+        if (token_is(type, "bool")) {
+            *tp = TYPE_BOOL;
+        } else if (token_is(type, "int") || token_is(type, "num")) {
+            *tp = TYPE_INT;
+        } else {
+            parse_error(type, "expected `bool`, `int` or `num`");
+        }
+    }
+    expect(lx, TOKEN_EQUALS, "expected `=`");
+    *sym = intern(name.text, name.len);
+    return true;
+}
+
+// Parses the next definition, `name = term` or `main type = term`, which
+// runs until the next one starts and may span lines. Returns NULL at the end
+// of the input.
+line_t *parse_definition(lexer *lx) {
+    symbol name;
+    display_type tp;
+    if (!parse_header(lx, &name, &tp)) return NULL;
+
+    line_t *ln = allocate(sizeof(line_t));
+    ln->name = name;
+    term *tm = parse(lx);
+    ln->body = pack(tm, NO_NODE);
+    release(tm);
+    ln->term = NULL;
+    ln->type = tp;
+    ln->normal = NULL;
+    ln->code = NULL;
+    ln->bytecode = NULL;
+    ln->native.kind = NATIVE_UNKNOWN;
+    ln->lazy = false;
+    return ln;
+}
+
+// Top-level definitions, an open-addressing hash map keyed by the interned
+// name. Slots with name == NO_SYMBOL are empty; deletion shifts the following
+// cluster back so no tombstones are needed.
+typedef struct {
+    line_t *slots;
+    size_t len;
+    size_t cap;     // always a power of two
+} table;
+
+size_t hash_symbol(symbol sym) {
+    return (size_t)sym * 0x9E3779B97F4A7C15ULL >> 17;
+}
+
+void table_grow(table *table) {
+    size_t cap = table->cap == 0 ? 64 : table->cap * 2;
+    line_t *slots = allocate(cap * sizeof(line_t));
+    for (size_t i = 0; i < cap; i++) slots[i].name = NO_SYMBOL;
+    for (size_t i = 0; i < table->cap; i++) {
+        if (table->slots[i].name == NO_SYMBOL) continue;
+        size_t h = hash_symbol(table->slots[i].name);
+        while (slots[h & (cap-1)].name != NO_SYMBOL) h++;
+        slots[h & (cap-1)] = table->slots[i];
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->cap = cap;
+}
+
+line_t *lookup(const table *table, symbol name) {
+    if (table->cap == 0) return NULL;
+    for (size_t h = hash_symbol(name);; h++) {
+        line_t *slot = &table->slots[h & (table->cap-1)];
+        if (slot->name == name) return slot;
+        if (slot->name == NO_SYMBOL) return NULL;
+    }
+}
+
+void release_code(struct mterm *code);
+
+// frees a definition's term and whatever was compiled from it
+void release_line(line_t *line) {
+    free(line->body);
+    if (line->term != NULL) release(line->term);
+    free(line->normal);
+    if (line->code != NULL) release_code(line->code);
+    free(line->bytecode);
+}
+
+void set(table *table, line_t *line) {
+    line_t *slot = lookup(table, line->name);
+    if (slot != NULL) {
+        release_line(slot);
+        *slot = *line;
+        return;
+    }
+    if ((table->len+1) * 4 > table->cap * 3) table_grow(table);
+
+    size_t h = hash_symbol(line->name);
+    while (table->slots[h & (table->cap-1)].name != NO_SYMBOL) h++;
+    table->slots[h & (table->cap-1)] = *line;
+    table->len++;
+}
+
+bool contains(const table *table, symbol name) {
+    return lookup(table, name) != NULL;
+}
+
+const packed *get(const table *table, symbol name) {
+    line_t *slot = lookup(table, name);
+    return slot == NULL ? NULL : slot->body;
+}
+
+// Stops with an error if the definition uses itself by name, as eval does
+// when it meets such a use. For the strategies that do not keep track of
+// which definition a term came from, checked as they enter it.
+void check_recursion(const line_t *line) {
+    const packed *body = line->body;
+    for (uint32_t i = 0; i < body->len; i++) {
+        if (body->tags[i] == PACKED_FREE && body->b[i] == 0
+            && body->a[i] == line->name) {
+            fprintf(error_out(),
+                    "ERROR: Recursion detected in function `%s`.\n",
+                    symbol_name(line->name));
+            give_up();
+        }
+    }
+}
+
+void delete(table *table, symbol name) {
+    line_t *slot = lookup(table, name);
+    if (slot == NULL) return;
+    release_line(slot);
+
+    size_t mask = table->cap-1;
+    size_t hole = slot - table->slots;
+    slot->name = NO_SYMBOL;
+    table->len--;
+
+    // backward-shift the rest of the cluster into the hole
+    for (size_t i = (hole+1) & mask; table->slots[i].name != NO_SYMBOL;
+         i = (i+1) & mask) {
+        size_t home = hash_symbol(table->slots[i].name) & mask;
+        // move it if its home slot is not cyclically within (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->slots[hole] = table->slots[i];
+            table->slots[i].name = NO_SYMBOL;
+            hole = i;
+        }
+    }
+}
+
+void dump_table(const table *table) {
+    for (size_t i = 0; i < table->cap; i++) {
+        const line_t *line = &table->slots[i];
+        if (line->name == NO_SYMBOL) continue;
+        printf("%zu: {name: '%s', term: ", i, symbol_name(line->name));
+        term *tm = unpack(line->body, false);
+        dump_(stdout, tm);
+        release(tm);
+        printf("}\n");
+    }
+}
+
+// Without --cache or --serve, only the definitions reachable from the entry
+// point are parsed. A first pass runs the lexer over the whole source to find
+// where each definition starts, stepping over the terms without building
+// them; the rest are then parsed on demand, following the names each one
+// uses. A syntax error in a definition nothing reaches goes unreported.
+
+// where a definition starts, to restart the lexer there
+typedef struct {
+    size_t pos;
+    size_t line;            // 0 if the name has no definition
+    size_t line_start;
+    size_t hash;            // of its tokens, to see whether it changed
+} source_offset;
+
+typedef struct {
+    symbol name;
+    source_offset at;
+} source_definition;
+
+// the definitions in the order they are written
+typedef STACK(source_definition) source_list;
+
+// the last definition of each name, indexed by symbol
+typedef STACK(source_offset) source_index;
+
+// Moves past a term, ending it where parse would, without building anything,
+// and returns `hash` extended with its tokens, so white space and comments do
+// not count. A `(` left open, or an `=` inside a term, would hide where the
+// next definition starts, so they are errors here too.
+size_t skip_term(lexer *lx, size_t hash) {
+    static STACK(token) open = {0};
+    open.len = 0;
+    for (;;) {
+        token tok = peek(lx, 0);
+        if (tok.kind == TOKEN_END && open.len > 0) {
+            fprintf(error_out(), "Parse error at line %zu, column %zu: "
+                    "`(` is never closed\n", TOP(open).line, TOP(open).column);
+            give_up();
+        }
+        if (tok.kind == TOKEN_END || (open.len == 0 && at_definition(lx))) {
+            return hash;
+        }
+        advance(lx);
+        hash = (hash ^ hash_name(tok.text, tok.len)) * 1099511628211ULL;
+        if (tok.kind == TOKEN_EQUALS) parse_error(tok, "expected a term");
+        if (tok.kind == TOKEN_OPEN) PUSH(open, tok);
+        if (tok.kind == TOKEN_CLOSE && open.len > 0) open.len--;
+    }
+}
+
+// Appends where the next definition starts to `defs`. Returns false at the
+// end of the input.
+bool index_next(lexer *lx, source_list *defs) {
+    token first = peek(lx, 0);
+    symbol name;
+    display_type tp;
+    if (!parse_header(lx, &name, &tp)) return false;
+    size_t pos = first.text - lx->src;
+    char type = tp;     // `main num =` and `main =` differ
+    source_offset at = {pos, first.line, pos - (first.column - 1),
+                        skip_term(lx, hash_name(&type, 1))};
+    PUSH(*defs, ((source_definition){name, at}));
+    return true;
+}
+
+// Indexes the definitions by name. A later definition of a name replaces an
+// earlier one, as with set.
+void index_by_name(const source_list *defs, source_index *index) {
+    index->len = 0;
+    for (size_t i = 0; i < defs->len; i++) {
+        symbol name = defs->items[i].name;
+        while (index->len <= name) {
+            PUSH(*index, ((source_offset){0, 0, 0, 0}));
+        }
+        index->items[name] = defs->items[i].at;
+    }
+}
+
+// Parses the definition of `entry` and, in turn, those of the names it uses
+// without binding them, unless they are in `functions` already. With
+// `recheck`, the names used by definitions already there are followed too,
+// to finish after a parse error left some out.
+void parse_reachable(table *functions, const char *src, size_t len,
+                     const source_index *index, symbol entry, bool recheck) {
+    symbol_stack pending = {0};
+    bool *seen = recheck ? allocate(index->len) : NULL;
+    if (recheck) memset(seen, 0, index->len);
+    PUSH(pending, entry);
+    while (pending.len > 0) {
+        symbol name = POP(pending);
+        if (name >= index->len || index->items[name].line == 0) continue;
+        if (recheck) {
+            if (seen[name]) continue;
+            seen[name] = true;
+            if (contains(functions, name)) {
+                packed_names(get(functions, name), &pending);
+                continue;
+            }
+        } else if (contains(functions, name)) {
+            continue;
+        }
+        source_offset at = index->items[name];
+        lexer lx;
+        lexer_init(&lx, src, len);
+        lx.pos = at.pos;
+        lx.line = at.line;
+        lx.line_start = at.line_start;
+        line_t *def = parse_definition(&lx);
+        set(functions, def);
+        free(def);
+        stats.parsed++;
+        packed_names(get(functions, name), &pending);
+    }
+    free(pending.items);
+    free(seen);
+}
+
+// a definition `user` that uses the name `used`
+typedef struct {
+    symbol used;
+    symbol user;
+} use_edge;
+
+// Drops from `functions` the definitions that were added, removed or edited
+// between the indexes `before` and `after`, and everything that uses them,
+// directly or not.
+void drop_changed(table *functions, const source_index *before,
+                  const source_index *after) {
+    size_t names = before->len > after->len ? before->len : after->len;
+    bool *dirty = allocate(names + 1);
+    memset(dirty, 0, names + 1);
+    symbol_stack todo = {0};
+    for (symbol name = 0; name < names; name++) {
+        source_offset none = {0, 0, 0, 0};
+        source_offset a = name < before->len ? before->items[name] : none;
+        source_offset b = name < after->len ? after->items[name] : none;
+        if ((a.line == 0) != (b.line == 0) || a.hash != b.hash) {
+            dirty[name] = true;
+            PUSH(todo, name);
+        }
+    }
+    if (todo.len == 0) {
+        free(dirty);
+        return;
+    }
+
+    // the users of each name, grouped by name: those of `name` are
+    // users[first[name]] up to users[first[name+1]]
+    STACK(use_edge) edges = {0};
+    symbol_stack used = {0};
+    for (size_t i = 0; i < functions->cap; i++) {
+        const line_t *line = &functions->slots[i];
+        if (line->name == NO_SYMBOL) continue;
+        used.len = 0;
+        packed_names(line->body, &used);
+        for (size_t j = 0; j < used.len; j++) {
+            if (used.items[j] < names) {
+                PUSH(edges, ((use_edge){used.items[j], line->name}));
+            }
+        }
+    }
+    size_t *first = allocate((names + 1) * sizeof(size_t));
+    memset(first, 0, (names + 1) * sizeof(size_t));
+    for (size_t i = 0; i < edges.len; i++) first[edges.items[i].used + 1]++;
+    for (size_t i = 0; i < names; i++) first[i+1] += first[i];
+    symbol *users = allocate((edges.len + 1) * sizeof(symbol));
+    size_t *next = allocate((names + 1) * sizeof(size_t));
+    memcpy(next, first, (names + 1) * sizeof(size_t));
+    for (size_t i = 0; i < edges.len; i++) {
+        users[next[edges.items[i].used]++] = edges.items[i].user;
+    }
+
+    while (todo.len > 0) {
+        symbol name = POP(todo);
+        for (size_t i = first[name]; i < first[name+1]; i++) {
+            if (dirty[users[i]]) continue;
+            dirty[users[i]] = true;
+            PUSH(todo, users[i]);
+        }
+    }
+    for (symbol name = 0; name < names; name++) {
+        if (dirty[name]) delete(functions, name);
+    }
+    free(dirty);
+    free(todo.items);
+    free(edges.items);
+    free(used.items);
+    free(first);
+    free(users);
+    free(next);
+}
+
+// With `--cache`, the parsed definitions are saved next to the source as
+// `<file>.cache` and loaded from there on later runs, as long as the hash and
+// size of the source still match. The file holds a header, one record per
+// definition, the packed nodes of every definition one after another, each
+// followed by its normal form if strict evaluation had kept one, as three
+// arrays (`a`, `b` and the tags, like a packed term's), and then the names
+// the records and nodes refer to by index, as NUL-terminated strings. It is
+// mapped privately and stays mapped: each definition's body and normal form
+// point into the arrays, so nothing is decoded or copied. Names are interned
+// in the order they were written, and only where that gives other symbols
+// than the writing run had are the names in `a` rewritten. A run that kept
+// normal forms the cache did not have writes it again, so later runs start
+// with them.
+
+#define CACHE_MAGIC   0x4c43434cu   // "LCCL"
+#define CACHE_VERSION 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint32_t definitions;
+    uint32_t nodes;
+    uint32_t names;
+    uint32_t name_bytes;
+} cache_header;
+
+typedef struct {
+    uint32_t name;
+    uint32_t type;          // a display_type
+    uint32_t nodes;         // the size of its term
+    uint32_t normal_nodes;  // the size of its normal form, 0 if none
+} cache_definition;
+
+// how many definitions have a normal form kept
+size_t kept_normals(const table *functions) {
+    size_t count = 0;
+    for (size_t i = 0; i < functions->cap; i++) {
+        const line_t *line = &functions->slots[i];
+        if (line->name != NO_SYMBOL
+            && __atomic_load_n(&line->normal, __ATOMIC_ACQUIRE) != NULL) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// writes one array of every packed term of `functions`, in the order of the
+// records: 0 for `a`, 1 for `b`, 2 for the tags
+bool cache_write_array(FILE *file, const table *functions, int array) {
+    for (size_t i = 0; i < functions->cap; i++) {
+        const line_t *line = &functions->slots[i];
+        if (line->name == NO_SYMBOL) continue;
+        const packed *terms[2] = {line->body, line->normal};
+        for (int t = 0; t < 2 && terms[t] != NULL; t++) {
+            const packed *p = terms[t];
+            bool ok = array == 0
+                ? fwrite(p->a, sizeof(uint32_t), p->len, file) == p->len
+                : array == 1
+                ? fwrite(p->b, sizeof(uint32_t), p->len, file) == p->len
+                : fwrite(p->tags, 1, p->len, file) == p->len;
+            if (!ok) return false;
+        }
+    }
+    return true;
+}
+
+// Writes the cache for `functions`. Names are written in the order they
+// were interned, so a node's name is its symbol, and the arrays of each
+// packed term go to the file as they are. It goes to a temporary file first
+// and is renamed into place, so runs started meanwhile see either the old
+// cache or the whole new one.
+void save_cache(const char *path, const table *functions,
+                uint64_t source_hash, uint64_t source_size) {
+    static STACK(cache_definition) defs = {0};
+    defs.len = 0;
+    uint64_t nodes = 0, name_bytes = 0;
+    for (size_t i = 0; i < functions->cap; i++) {
+        const line_t *line = &functions->slots[i];
+        if (line->name == NO_SYMBOL) continue;
+        const packed *normal = line->normal;
+        cache_definition def = {line->name, line->type, line->body->len,
+                                normal != NULL ? normal->len : 0};
+        PUSH(defs, def);
+        nodes += def.nodes + def.normal_nodes;
+    }
+    size_t names = symbol_count();
+    for (size_t i = 0; i < names; i++) {
+        name_bytes += strlen(symbol_name(i)) + 1;
+    }
+    if (nodes > UINT32_MAX || name_bytes > UINT32_MAX) return;  // too big
+    cache_header header = {
+        CACHE_MAGIC, CACHE_VERSION, source_hash, source_size,
+        defs.len, nodes, names, name_bytes,
+    };
+
+    size_t tmp_len = strlen(path) + 32;
+    char *tmp = allocate(tmp_len);
+    snprintf(tmp, tmp_len, "%s.%ld", path, (long)getpid());
+    FILE *file = fopen(tmp, "wb");
+    bool ok = file != NULL
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(defs.items, sizeof(cache_definition), defs.len,
+                  file) == defs.len
+        && cache_write_array(file, functions, 0)
+        && cache_write_array(file, functions, 1)
+        && cache_write_array(file, functions, 2);
+    for (size_t i = 0; ok && i < names; i++) {
+        const char *name = symbol_name(i);
+        ok = fwrite(name, 1, strlen(name) + 1, file) == strlen(name) + 1;
+    }
+    if (file != NULL && fclose(file) != 0) ok = false;
+    if (ok && rename(tmp, path) != 0) ok = false;
+    if (!ok) {
+        fprintf(stderr, "ERROR: could not write cache %s: %s (ERRNO %d)\n",
+                path, strerror(errno), errno);
+        remove(tmp);
+    }
+    free(tmp);
+}
+
+// a node still expected while checking a cached term, as in unpack
+typedef struct {
+    uint32_t depth;     // binders around it
+    uint32_t app;       // the application it is the argument of, if any
+} cache_item;
+
+// Checks the `len` nodes from `start` on: they must hold exactly one term,
+// whose applications say where their arguments start and whose bound
+// variables are in scope. The binders of a parsed term are at generation 0;
+// those of a normal form are renamed when it is used.
+bool cache_term_valid(const cache_header *header, const uint32_t *a,
+                      const uint32_t *b, const uint8_t *tags, uint32_t start,
+                      uint32_t len, bool parsed) {
+    static STACK(cache_item) todo = {0};
+    todo.len = 0;
+    PUSH(todo, ((cache_item){0, NO_NODE}));
+    for (uint32_t j = 0; j < len; j++) {
+        uint32_t n = start + j;
+        if (todo.len == 0) return false;
+        cache_item item = POP(todo);
+        if (item.app != NO_NODE && b[start + item.app] != j) return false;
+        switch (tags[n]) {
+        case PACKED_ABSTRACTION:
+            if (a[n] >= header->names || (parsed && b[n] != 0)) return false;
+            PUSH(todo, ((cache_item){item.depth + 1, NO_NODE}));
+            break;
+        case PACKED_APPLICATION:
+            PUSH(todo, ((cache_item){item.depth, j}));
+            PUSH(todo, ((cache_item){item.depth, NO_NODE}));
+            break;
+        case PACKED_BOUND:
+            if (a[n] >= item.depth) return false;
+            break;
+        case PACKED_FREE:
+            if (a[n] >= header->names || b[n] != 0) return false;
+            break;
+        default:
+            return false;
+        }
+    }
+    return todo.len == 0;
+}
+
+// checks the records and nodes of a mapped cache before anything points
+// into it
+bool cache_valid(const cache_header *header, const cache_definition *defs,
+                 const uint32_t *a, const uint32_t *b, const uint8_t *tags) {
+    uint32_t start = 0;
+    for (size_t i = 0; i < header->definitions; i++) {
+        if (defs[i].name >= header->names || defs[i].type > TYPE_BOOL
+            || defs[i].nodes > header->nodes - start
+            || !cache_term_valid(header, a, b, tags, start, defs[i].nodes,
+                                 true)) {
+            return false;
+        }
+        start += defs[i].nodes;
+        if (defs[i].normal_nodes == 0) continue;
+        if (defs[i].normal_nodes > header->nodes - start
+            || !cache_term_valid(header, a, b, tags, start,
+                                 defs[i].normal_nodes, false)) {
+            return false;
+        }
+        start += defs[i].normal_nodes;
+    }
+    return start == header->nodes;
+}
+
+// Loads the cached definitions of a source with this hash and size into
+// `functions`. Returns false, having added nothing, if the cache is missing,
+// stale or damaged.
+bool load_cache(const char *path, table *functions,
+                uint64_t source_hash, uint64_t source_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(cache_header)) {
+        map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const cache_header *header = (const cache_header*)map;
+    const cache_definition *defs = (const cache_definition*)(header + 1);
+    uint32_t *a = (uint32_t*)(defs + header->definitions);
+    uint32_t *b = a + header->nodes;
+    uint8_t *tags = (uint8_t*)(b + header->nodes);
+    const char *names = (const char*)(tags + header->nodes);
+    symbol *syms = NULL;
+    bool ok = header->magic == CACHE_MAGIC
+        && header->version == CACHE_VERSION
+        && header->source_hash == source_hash
+        && header->source_size == source_size
+        && (uint64_t)st.st_size == sizeof(cache_header)
+            + (uint64_t)header->definitions * sizeof(cache_definition)
+            + (uint64_t)header->nodes * (2 * sizeof(uint32_t) + 1)
+            + header->name_bytes
+        && header->names <= header->name_bytes
+        && (header->name_bytes == 0
+            || names[header->name_bytes-1] == '\0')
+        && cache_valid(header, defs, a, b, tags);
+    if (ok) {
+        syms = allocate(header->names * sizeof(symbol));
+        const char *name = names, *end = names + header->name_bytes;
+        for (size_t i = 0; i < header->names; i++) {
+            if (name == end) {
+                ok = false;
+                break;
+            }
+            size_t len = strlen(name);
+            syms[i] = intern(name, len);
+            name += len + 1;
+        }
+    }
+    if (!ok) {
+        free(syms);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    // untouched pages of `a` stay shared with the file
+    for (uint32_t n = 0; n < header->nodes; n++) {
+        bool named = tags[n] == PACKED_ABSTRACTION || tags[n] == PACKED_FREE;
+        if (named && syms[a[n]] != a[n]) a[n] = syms[a[n]];
+    }
+    uint32_t start = 0;
+    for (size_t i = 0; i < header->definitions; i++) {
+        // freed with the definition like any packed term; the arrays stay
+        // mapped
+        packed *body = allocate(sizeof(packed));
+        *body = (packed){defs[i].nodes, a + start, b + start, tags + start,
+                         NULL, 0};
+        start += defs[i].nodes;
+        packed *normal = NULL;
+        if (defs[i].normal_nodes > 0) {
+            normal = allocate(sizeof(packed));
+            *normal = (packed){defs[i].normal_nodes, a + start, b + start,
+                               tags + start, NULL, 0};
+            start += defs[i].normal_nodes;
+        }
+        line_t line = {syms[defs[i].name], body, NULL, defs[i].type, normal,
+                       NULL, NULL, {NATIVE_UNKNOWN, NO_SYMBOL, 0}, false};
+        set(functions, &line);
+    }
+    free(syms);
+    return true;
+}
+
+// a source node still to be copied, and where to put the copy
+typedef struct {
+    const term *src;
+    term **dst;
+    size_t depth;       // number of renamings in scope at `src`
+} clone_item;
+
+// a binder met on the way down and its fresh replacement
+typedef struct {
+    variable from;
+    variable to;
+} renaming;
+
+// copies a term, giving every binder in the copy a fresh generation
+term *clone(const term *other) {
+    static _Thread_local STACK(clone_item) todo = {0};
+    static _Thread_local STACK(renaming) scope = {0};
+    size_t st = ++stamp;
+    term *root;
+    stats.clones++;
+    todo.len = 0;
+    PUSH(todo, ((clone_item){other, &root, 0}));
+    while (todo.len > 0) {
+        clone_item item = POP(todo);
+        const term *src = item.src;
+        term *new = new_term();
+        stats.clone_nodes++;
+        *item.dst = new;
+        new->type = src->type;
+        new->origin = src->origin;
+        // everything above `depth` belonged to a subtree already copied
+        scope.len = item.depth;
+        switch (src->type) {
+        case TYPE_ABSTRACTION: {
+            variable arg = src->value.abstraction.arg;
+            renaming r = {arg, fresh(arg.name)};
+            PUSH(scope, r);
+            new->value.abstraction.arg = r.to;
+            PUSH(todo, ((clone_item){src->value.abstraction.term,
+                                     &new->value.abstraction.term,
+                                     scope.len}));
+            break;
+        } case TYPE_APPLICATION:
+            PUSH(todo, ((clone_item){src->value.application.right,
+                                     &new->value.application.right,
+                                     scope.len}));
+            PUSH(todo, ((clone_item){src->value.application.left,
+                                     &new->value.application.left,
+                                     scope.len}));
+            break;
+        case TYPE_VARIABLE:
+            new->value.var = src->value.var;
+            for (size_t i = scope.len; i-- > 0;) {
+                if (var_eq(scope.items[i].from, src->value.var)) {
+                    new->value.var = scope.items[i].to;
+                    break;
+                }
+            }
+            break;
+        case TYPE_SHARED: {
+            thunk *th = src->value.shared;
+            if (!th->open) {
+                th->refs++;
+                new->value.shared = th;
+                break;
+            }
+            if (th->copied != st) {
+                th->copied = st;
+                th->copy = new_thunk(NULL, 0, true);
+                th->copy->normal = th->normal;
+                PUSH(todo, ((clone_item){th->term, &th->copy->term,
+                                         scope.len}));
+            }
+            th->copy->refs++;
+            new->value.shared = th->copy;
+            break;
+        } case TYPE_NATIVE:
+            new->value.native = src->value.native;
+            break;
+        }
+    }
+    return root;
+}
+
+// Collects the nodes where `var` occurs free in `tm` into `found`. Open thunks
+// are searched once however many references lead to them, and lose their
+// normal form flag since a substitution is about to change them.
+void occurrences(term *tm, variable var, term_stack *found) {
+    static _Thread_local term_stack todo = {0};
+    size_t st = ++stamp;
+    todo.len = 0;
+    PUSH(todo, tm);
+    while (todo.len > 0) {
+        tm = POP(todo);
+        switch (tm->type) {
+        case TYPE_ABSTRACTION:
+            if (var_eq(tm->value.abstraction.arg, var)) break;
+            PUSH(todo, tm->value.abstraction.term);
+            break;
+        case TYPE_APPLICATION:
+            PUSH(todo, tm->value.application.right);
+            PUSH(todo, tm->value.application.left);
+            break;
+        case TYPE_VARIABLE:
+            if (var_eq(tm->value.var, var)) PUSH(*found, tm);
+            break;
+        case TYPE_NATIVE:
+            break;
+        case TYPE_SHARED: {
+            thunk *th = tm->value.shared;
+            if (!th->open || th->visit == st) break;
+            th->visit  = st;
+            th->normal = false;
+            PUSH(todo, th->term);
+            break;
+        }}
+    }
+}
+
+// Substitutes `value` for the occurrences in `found`. All but the last get a
+// fresh copy; the last one takes `value` itself, so the argument is consumed
+// either way.
+void update(const term_stack *found, term *value) {
+    for (size_t i = 0; i < found->len; i++) {
+        term *copy = i+1 == found->len ? value : clone(value);
+        *found->items[i] = *copy;
+        free_term(copy);
+    }
+}
+
+// beta-reduces the redex `tm`, whose left side is an abstraction
+void substitute(term *tm) {
+    static _Thread_local term_stack found = {0};
+    term *left  = tm->value.application.left;
+    term *right = tm->value.application.right;
+    term *body  = left->value.abstraction.term;
+
+    // charged to the definition the abstraction came from
+    if (profile_path != NULL) profile_switch(left->origin);
+    WORK(betas);
+    found.len = 0;
+    occurrences(body, left->value.abstraction.arg, &found);
+    if (found.len == 0) {
+        release(right);
+    } else {
+        update(&found, right);
+    }
+
+    *tm = *body;
+    free_term(body);
+    free_term(left);
+}
+
+// Native numerals: with `--native`, definitions shaped like Church numerals,
+// true, or the successor, addition, multiplication and power combinators are
+// replaced by TYPE_NATIVE leaves, and applications of the combinators to
+// native numbers are computed with integer arithmetic. A native that meets
+// anything else is unfolded back into its lambda term, and whatever is left
+// at the end is turned back into lambda terms, so results do not change.
+
+// per thread, since eval_line turns it off for its second pass
+_Thread_local bool native_enabled = false;
+
+// the canonical shapes of the combinators; the free name `succ` stands for
+// anything recognised as the successor
+static const struct {
+    native_kind kind;
+    const char *source;
+} native_patterns[] = {
+    {NATIVE_TRUE, "\\a.\\b. a"},
+    {NATIVE_SUCC, "\\n.\\f.\\v. f (n f v)"},
+    {NATIVE_SUCC, "\\n.\\f.\\v. n f (f v)"},
+    {NATIVE_ADD,  "\\a.\\b. b succ a"},
+    {NATIVE_ADD,  "\\a.\\b. a succ b"},
+    {NATIVE_ADD,  "\\a.\\b.\\f.\\v. a f (b f v)"},
+    {NATIVE_MUL,  "\\a.\\b.\\f. a (b f)"},
+    {NATIVE_POW,  "\\a.\\b. b a"},
+};
+
+#define NATIVE_PATTERNS (sizeof(native_patterns) / sizeof(*native_patterns))
+#define PATTERN_DEPTH 8
+
+const native *classify(const table *functions, symbol name);
+
+// the pattern `k`, parsed on first use
+const term *native_pattern(size_t k) {
+    static term *parsed[NATIVE_PATTERNS] = {0};
+    if (parsed[k] == NULL) {
+        parsed[k] = parse_string(native_patterns[k].source);
+    }
+    return parsed[k];
+}
+
+// the value of a numeral `\f.\v. f (f (... v))`
+bool numeral_value(const term *tm, uint64_t *n) {
+    if (tm->type != TYPE_ABSTRACTION) return false;
+    variable f = tm->value.abstraction.arg;
+    tm = tm->value.abstraction.term;
+    if (tm->type != TYPE_ABSTRACTION) return false;
+    variable v = tm->value.abstraction.arg;
+    if (var_eq(f, v)) return false;
+    tm = tm->value.abstraction.term;
+
+    *n = 0;
+    while (tm->type == TYPE_APPLICATION) {
+        const term *left = tm->value.application.left;
+        if (left->type != TYPE_VARIABLE || !var_eq(left->value.var, f)) {
+            return false;
+        }
+        tm = tm->value.application.right;
+        (*n)++;
+    }
+    return tm->type == TYPE_VARIABLE && var_eq(tm->value.var, v);
+}
+
+// Whether `tm` is `pattern` up to the names of bound variables. `scope`
+// pairs the binders met on the way down, innermost last. Patterns are a few
+// nodes deep, so plain recursion is fine here.
+bool match(const table *functions, const term *tm, const term *pattern,
+           renaming *scope, size_t depth) {
+    if (pattern->type == TYPE_VARIABLE) {
+        variable pvar = pattern->value.var;
+        size_t i = depth;
+        while (i > 0 && !var_eq(scope[i-1].to, pvar)) i--;
+        if (i > 0) {
+            // bound in the pattern, must be bound by the same binder
+            if (tm->type != TYPE_VARIABLE) return false;
+            size_t j = depth;
+            while (j > 0 && !var_eq(scope[j-1].from, tm->value.var)) j--;
+            return i == j;
+        }
+        // the placeholder for a successor
+        if (tm->type == TYPE_VARIABLE) {
+            variable var = tm->value.var;
+            for (size_t j = 0; j < depth; j++) {
+                if (var_eq(scope[j].from, var)) return false;
+            }
+            return var.gen == 0 && contains(functions, var.name)
+                && classify(functions, var.name)->kind == NATIVE_SUCC;
+        }
+        for (size_t k = 0; k < NATIVE_PATTERNS; k++) {
+            if (native_patterns[k].kind != NATIVE_SUCC) continue;
+            renaming inner[PATTERN_DEPTH];
+            if (match(functions, tm, native_pattern(k), inner, 0)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (tm->type != pattern->type) return false;
+
+    switch (pattern->type) {
+    case TYPE_ABSTRACTION:
+        if (depth == PATTERN_DEPTH) return false;
+        scope[depth].from = tm->value.abstraction.arg;
+        scope[depth].to   = pattern->value.abstraction.arg;
+        return match(functions, tm->value.abstraction.term,
+                     pattern->value.abstraction.term, scope, depth+1);
+    case TYPE_APPLICATION:
+        return match(functions, tm->value.application.left,
+                     pattern->value.application.left, scope, depth)
+            && match(functions, tm->value.application.right,
+                     pattern->value.application.right, scope, depth);
+    default:
+        return false;
+    }
+}
+
+// recognises a definition, remembering the answer in its line
+const native *classify(const table *functions, symbol name) {
+    line_t *line = lookup(functions, name);
+    if (line->native.kind != NATIVE_UNKNOWN) return &line->native;
+    // guards against definitions that refer to themselves
+    line->native.kind = NATIVE_NONE;
+
+    term *tm = unpack(line->body, false);
+    uint64_t n;
+    if (tm->type == TYPE_VARIABLE) {
+        // an alias such as `K = true`
+        variable var = tm->value.var;
+        if (var.gen == 0 && contains(functions, var.name)) {
+            line->native = *classify(functions, var.name);
+        }
+    } else if (numeral_value(tm, &n)) {
+        line->native.kind   = NATIVE_NUMBER;
+        line->native.number = n;
+    } else {
+        for (size_t k = 0; k < NATIVE_PATTERNS; k++) {
+            renaming scope[PATTERN_DEPTH];
+            if (match(functions, tm, native_pattern(k), scope, 0)) {
+                line->native.kind = native_patterns[k].kind;
+                line->native.name = name;
+                break;
+            }
+        }
+    }
+    release(tm);
+    return &line->native;
+}
+
+// Turns a reference to a global into a native leaf if the definition was
+// recognised. Returns false if it was not.
+bool native_global(const table *functions, term *tm) {
+    variable var = tm->value.var;
+    if (var.gen != 0 || !contains(functions, var.name)) return false;
+    const native *nat = classify(functions, var.name);
+    if (nat->kind == NATIVE_NONE) return false;
+    tm->type = TYPE_NATIVE;
+    tm->value.native = *nat;
+    return true;
+}
+
+// the Church numeral `\f.\v. f (f (... v))` for `n`
+term *numeral(uint64_t n) {
+    variable f = fresh(intern("f", 1));
+    variable v = fresh(intern("v", 1));
+    term *root = new_term();
+    root->type = TYPE_ABSTRACTION;
+    root->value.abstraction.arg = f;
+    term *inner = new_term();
+    inner->type = TYPE_ABSTRACTION;
+    inner->value.abstraction.arg = v;
+    root->value.abstraction.term = inner;
+
+    term **dst = &inner->value.abstraction.term;
+    for (uint64_t i = 0; i < n; i++) {
+        term *app = new_term();
+        term *head = new_term();
+        head->type = TYPE_VARIABLE;
+        head->value.var = f;
+        app->type = TYPE_APPLICATION;
+        app->value.application.left = head;
+        *dst = app;
+        dst = &app->value.application.right;
+    }
+    term *last = new_term();
+    last->type = TYPE_VARIABLE;
+    last->value.var = v;
+    *dst = last;
+    return root;
+}
+
+// replaces the native `tm` refers to by its lambda term
+void unfold_native(const table *functions, term *tm) {
+    const native *nat = &deref(tm)->value.native;
+    term *lambda;
+    if (nat->kind == NATIVE_NUMBER) {
+        lambda = numeral(nat->number);
+    } else {
+        lambda = unpack(get(functions, nat->name), true);
+        WORK(unfoldings);
+    }
+    if (tm->type == TYPE_SHARED) drop(tm->value.shared);
+    *tm = *lambda;
+    free_term(lambda);
+}
+
+bool power(uint64_t base, uint64_t exp, uint64_t *result) {
+    uint64_t acc = 1;
+    while (exp > 0) {
+        if (exp & 1 && __builtin_mul_overflow(acc, base, &acc)) return false;
+        exp >>= 1;
+        if (exp > 0 && __builtin_mul_overflow(base, base, &base)) return false;
+    }
+    *result = acc;
+    return true;
+}
+
+typedef enum {
+    NATIVE_STUCK,       // not a native application, or waiting for arguments
+    NATIVE_FORCE,       // an argument has to be reduced to whnf first
+    NATIVE_REDUCED,     // the application has been rewritten
+} native_result;
+
+// Replaces `node`, the application of the head of `spine` to its first `m`
+// arguments, by `result`. `keep` is the argument that `result` is taken from,
+// or SIZE_MAX; everything else is released.
+void native_rewrite(term **spine, size_t k, size_t m, term *result,
+                    size_t keep) {
+    term *node = spine[k-m];
+    release(spine[k-1]->value.application.left);
+    for (size_t i = 0; i < m; i++) {
+        term *app = spine[k-1-i];
+        if (i != keep) release(app->value.application.right);
+        if (app != node) free_term(app);
+    }
+    *node = *result;
+    free_term(result);
+}
+
+// Takes one step on the application `tm` if its head is a native. Under
+// call-by-need (`forced` not NULL) the arguments are still unevaluated:
+// the ones before `*forced` have been brought to whnf, and NATIVE_FORCE
+// asks for the next, in `*node`. Otherwise `*node` is the rewritten node.
+native_result native_step(const table *functions, term *tm, size_t *forced,
+                          term **node) {
+    static _Thread_local term_stack spine = {0};
+    spine.len = 0;
+    term *head = tm;
+    while (head->type == TYPE_APPLICATION) {
+        PUSH(spine, head);
+        head = head->value.application.left;
+    }
+    head = deref(head);
+    if (head->type != TYPE_NATIVE) return NATIVE_STUCK;
+
+    term **apps = spine.items;
+    size_t k = spine.len;
+    native nat = head->value.native;
+    // the argument `i`, counted from the head
+#define ARG(i) (apps[k-1-(i)]->value.application.right)
+#define NEED(i)                                                         \
+    do {                                                                \
+        if (forced != NULL && *forced <= (i)) {                         \
+            *node = ARG(i);                                             \
+            *forced = (i)+1;                                            \
+            return NATIVE_FORCE;                                        \
+        }                                                               \
+    } while (0)
+#define IS_NUMBER(tm) ((tm)->type == TYPE_NATIVE                        \
+                       && (tm)->value.native.kind == NATIVE_NUMBER)
+#define IS_SUCC(tm) ((tm)->type == TYPE_NATIVE                          \
+                     && (tm)->value.native.kind == NATIVE_SUCC)
+
+    term *result = new_term();
+    result->type = TYPE_NATIVE;
+    result->value.native.kind = NATIVE_NUMBER;
+    result->value.native.name = NO_SYMBOL;
+    uint64_t *r = &result->value.native.number;
+    size_t arity = nat.kind == NATIVE_SUCC ? 1 : 2;
+    const term *a, *b;
+    if (k < arity && !(nat.kind == NATIVE_NUMBER && k == 1)) {
+        free_term(result);
+        return NATIVE_STUCK;
+    }
+
+    switch (nat.kind) {
+    case NATIVE_TRUE:
+        free_term(result);
+        result = ARG(0);
+        *node = apps[k-2];
+        native_rewrite(apps, k, 2, result, 0);
+        return NATIVE_REDUCED;
+    case NATIVE_NUMBER:
+        if (nat.number == 0 && k >= 2) {
+            free_term(result);
+            result = ARG(1);
+            *node = apps[k-2];
+            native_rewrite(apps, k, 2, result, 1);
+            return NATIVE_REDUCED;
+        }
+        NEED(0);
+        a = deref(ARG(0));
+        // n m is m^n, unless n is 0, when it is the identity
+        if (IS_NUMBER(a) && nat.number > 0
+            && power(a->value.native.number, nat.number, r)) {
+            *node = apps[k-1];
+            native_rewrite(apps, k, 1, result, SIZE_MAX);
+            return NATIVE_REDUCED;
+        }
+        if (IS_SUCC(a)) {
+            if (k == 1) {
+                free_term(result);
+                return NATIVE_STUCK;
+            }
+            NEED(1);
+            b = deref(ARG(1));
+            if (IS_NUMBER(b) && !__builtin_add_overflow(
+                    nat.number, b->value.native.number, r)) {
+                *node = apps[k-2];
+                native_rewrite(apps, k, 2, result, SIZE_MAX);
+                return NATIVE_REDUCED;
+            }
+        }
+        break;
+    case NATIVE_SUCC:
+        NEED(0);
+        a = deref(ARG(0));
+        if (IS_NUMBER(a) && !__builtin_add_overflow(
+                a->value.native.number, 1, r)) {
+            *node = apps[k-1];
+            native_rewrite(apps, k, 1, result, SIZE_MAX);
+            return NATIVE_REDUCED;
+        }
+        break;
+    case NATIVE_ADD:
+    case NATIVE_MUL:
+    case NATIVE_POW: {
+        NEED(0);
+        a = deref(ARG(0));
+        if (!IS_NUMBER(a)) break;
+        uint64_t x = a->value.native.number;
+        if (nat.kind == NATIVE_MUL && x == 0) {
+            // 0 * b is 0 whatever b is
+            *r = 0;
+            *node = apps[k-2];
+            native_rewrite(apps, k, 2, result, SIZE_MAX);
+            return NATIVE_REDUCED;
+        }
+        NEED(1);
+        b = deref(ARG(1));
+        if (!IS_NUMBER(b)) break;
+        uint64_t y = b->value.native.number;
+        bool ok = nat.kind == NATIVE_ADD ? !__builtin_add_overflow(x, y, r)
+            : nat.kind == NATIVE_MUL ? !__builtin_mul_overflow(x, y, r)
+            // a^0 is the identity, not the numeral 1
+            : y > 0 && power(x, y, r);
+        if (!ok) break;
+        *node = apps[k-2];
+        native_rewrite(apps, k, 2, result, SIZE_MAX);
+        return NATIVE_REDUCED;
+    }
+    case NATIVE_UNKNOWN:
+    case NATIVE_NONE:
+        assert(false);
+        break;
+    }
+#undef ARG
+#undef NEED
+#undef IS_NUMBER
+#undef IS_SUCC
+
+    // the arguments do not fit, go back to the lambda term
+    free_term(result);
+    *node = apps[k-1]->value.application.left;
+    unfold_native(functions, *node);
+    return NATIVE_REDUCED;
+}
+
+// Turns the natives left in a result back into lambda terms. Returns true if
+// that left something to reduce: a combinator, or a number applied to
+// something it could not be computed with.
+bool unnative(const table *functions, term *tm) {
+    static _Thread_local term_stack todo = {0};
+    bool residual = false;
+    todo.len = 0;
+    PUSH(todo, tm);
+    while (todo.len > 0) {
+        tm = POP(todo);
+        switch (tm->type) {
+        case TYPE_ABSTRACTION:
+            PUSH(todo, tm->value.abstraction.term);
+            break;
+        case TYPE_APPLICATION:
+            if (tm->value.application.left->type == TYPE_NATIVE) {
+                residual = true;
+            }
+            PUSH(todo, tm->value.application.right);
+            PUSH(todo, tm->value.application.left);
+            break;
+        case TYPE_VARIABLE:
+        case TYPE_SHARED:
+            break;
+        case TYPE_NATIVE: {
+            residual = residual || tm->value.native.kind != NATIVE_NUMBER;
+            unfold_native(functions, tm);
+            break;
+        }}
+    }
+    return residual;
+}
+
+// Parallel reduction: with `--threads=N`, the strict strategy offers the
+// argument of an application to other threads while it reduces the head,
+// if the argument is big enough to be worth it and some thread is idle.
+// Each thread keeps the tasks it forked in a deque of its own, takes them
+// back if nobody has started them by the time it needs them, and steals the
+// oldest tasks of others when it has nothing to do. Under strict evaluation
+// terms are trees, so the argument and the head share no nodes; pools,
+// stacks and counters are per thread.
+
+#define DEQUE_SIZE  1024    // tasks a thread can have forked at once
+#define FORK_CUTOFF 256     // the smallest argument offered, in nodes
+#define HELP_DEPTH  64      // stolen tasks run inside one another at most
+
+typedef struct {
+    const table *functions;
+    symbol current_function;
+    term *tm;
+    bool done;
+    bool head_stuck;    // how the head ended, if it is taken back
+} task;
+
+// a Chase-Lev deque: the owner works at the bottom, thieves at the top
+typedef struct {
+    long top;
+    long bottom;
+    task *items[DEQUE_SIZE];
+} deque;
+
+typedef struct {
+    pthread_t thread;
+    deque tasks;
+    counters stats;     // what the thread counted, once it has stopped
+    ptrdiff_t peak;
+} worker;
+
+#define MAX_THREADS 1024
+
+size_t worker_count = 1;        // set by --threads
+worker *workers = NULL;         // while a parallel reduction runs
+bool workers_stop = false;
+size_t idle_workers = 0;        // threads looking for something to steal
+_Thread_local worker *self = NULL;
+
+bool deque_push(deque *d, task *t) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - top >= DEQUE_SIZE) return false;
+    __atomic_store_n(&d->items[b % DEQUE_SIZE], t, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELEASE);
+    return true;
+}
+
+task *deque_pop(deque *d) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (top > b) {
+        __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    task *t = __atomic_load_n(&d->items[b % DEQUE_SIZE], __ATOMIC_RELAXED);
+    if (top == b) {
+        // the last task: race the thieves for it
+        if (!__atomic_compare_exchange_n(&d->top, &top, top+1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            t = NULL;
+        }
+        __atomic_store_n(&d->bottom, b+1, __ATOMIC_RELAXED);
+    }
+    return t;
+}
+
+task *deque_steal(deque *d) {
+    long top = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (top >= b) return NULL;
+    task *t = __atomic_load_n(&d->items[top % DEQUE_SIZE], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &top, top+1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return t;
+}
+
+// tries every other thread once, starting at a different one each time
+task *steal(void) {
+    static _Thread_local size_t next = 0;
+    size_t start = next++;
+    for (size_t i = 0; i < worker_count; i++) {
+        worker *w = &workers[(start + i) % worker_count];
+        if (w == self) continue;
+        task *t = deque_steal(&w->tasks);
+        if (t != NULL) return t;
+    }
+    return NULL;
+}
+
+// Whether the argument `tm` should be offered to the idle threads: it must
+// have FORK_CUTOFF nodes, and something to reduce among the first of them.
+// A big normal term, like a numeral, is not worth a task. A look that finds
+// nothing skips as many of the following checks as it visited nodes, so the
+// nested arguments of one big term are not walked over and over.
+bool worth_forking(const table *functions, const term *tm) {
+    static _Thread_local size_t skip = 0;
+    deque *d = &self->tasks;
+    long queued = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED)
+        - __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if ((long)__atomic_load_n(&idle_workers, __ATOMIC_RELAXED) <= queued) {
+        return false;
+    }
+    if (skip > 0) {
+        skip--;
+        return false;
+    }
+
+    static _Thread_local STACK(const term*) todo = {0};
+    size_t nodes = 0;
+    bool work = false;
+    todo.len = 0;
+    PUSH(todo, tm);
+    while (todo.len > 0 && nodes < FORK_CUTOFF) {
+        tm = POP(todo);
+        nodes++;
+        switch (tm->type) {
+        case TYPE_ABSTRACTION:
+            PUSH(todo, tm->value.abstraction.term);
+            break;
+        case TYPE_APPLICATION:
+            work |= tm->value.application.left->type == TYPE_ABSTRACTION;
+            PUSH(todo, tm->value.application.right);
+            PUSH(todo, tm->value.application.left);
+            break;
+        case TYPE_VARIABLE:
+            work |= tm->value.var.gen == 0
+                && contains(functions, tm->value.var.name);
+            break;
+        default:
+            break;
+        }
+    }
+    if (nodes >= FORK_CUTOFF && work) return true;
+    skip = nodes;
+    return false;
+}
+
+bool eval(const table *functions, symbol current_function, term *tm);
+
+void run_task(task *t) {
+    eval(t->functions, t->current_function, t->tm);
+    __atomic_store_n(&t->done, true, __ATOMIC_RELEASE);
+}
+
+// tasks are only ever finished by the thread that forked them, so each
+// thread can keep the ones it is done with for its next forks
+_Thread_local STACK(task*) spare_tasks = {0};
+
+void finish_task(task *t) {
+    PUSH(spare_tasks, t);
+}
+
+// offers the reduction of `tm` to other threads; NULL if the deque is full
+task *fork_task(const table *functions, symbol current_function, term *tm) {
+    task *t = spare_tasks.len > 0 ? POP(spare_tasks) : allocate(sizeof(task));
+    *t = (task){functions, current_function, tm, false, false};
+    if (!deque_push(&self->tasks, t)) {
+        finish_task(t);
+        return NULL;
+    }
+    return t;
+}
+
+// Takes `t` back if no other thread has started it. Every task forked after
+// it has been joined already, so it is the one at the bottom of the deque,
+// and if it was stolen, so was everything older and the deque is empty.
+bool take_back(task *t) {
+    task *own = deque_pop(&self->tasks);
+    assert(own == NULL || own == t);
+    return own != NULL;
+}
+
+// yields the processor after a miss, and sleeps a little after many
+void back_off(size_t misses) {
+    if (misses < 64) {
+        sched_yield();
+    } else {
+        nanosleep(&(struct timespec){0, 50000}, NULL);
+    }
+}
+
+// waits for the thief of `t`, running the tasks of others meanwhile
+void wait_for(task *t) {
+    static _Thread_local size_t depth = 0;
+    size_t misses = 0;
+    while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+        task *other = depth < HELP_DEPTH ? steal() : NULL;
+        if (other == NULL) {
+            back_off(misses++);
+            continue;
+        }
+        misses = 0;
+        depth++;
+        run_task(other);
+        depth--;
+    }
+    finish_task(t);
+}
+
+void *work(void *arg) {
+    self = arg;
+    eval_budget = workers_budget;
+    eval_budget.betas = stats.betas;    // a worker counts its own steps
+    eval_budget.started = seconds();
+    size_t misses = 0;
+    while (!__atomic_load_n(&workers_stop, __ATOMIC_ACQUIRE)) {
+        task *t = steal();
+        if (t != NULL) {
+            if (misses > 0) {
+                __atomic_fetch_sub(&idle_workers, 1, __ATOMIC_RELAXED);
+            }
+            misses = 0;
+            run_task(t);
+            continue;
+        }
+        if (misses == 0) {
+            __atomic_fetch_add(&idle_workers, 1, __ATOMIC_RELAXED);
+        }
+        back_off(misses++);
+    }
+    self->stats = stats;
+    self->peak = pool.peak;
+    return NULL;
+}
+
+void start_workers(void) {
+    workers = allocate(worker_count * sizeof(worker));
+    memset(workers, 0, worker_count * sizeof(worker));
+    workers_stop = false;
+    idle_workers = 0;
+    workers_budget = eval_budget;
+    self = &workers[0];
+    for (size_t i = 1; i < worker_count; i++) {
+        int err = pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+        if (err != 0) {
+            fprintf(stderr, "ERROR: could not start a thread: %s\n",
+                    strerror(err));
+            exit(1);
+        }
+    }
+}
+
+// stops the workers and adds up what they counted
+void stop_workers(void) {
+    __atomic_store_n(&workers_stop, true, __ATOMIC_RELEASE);
+    for (size_t i = 1; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+#define ADD_COUNTER(name) stats.name += workers[i].stats.name;
+        STATS_COUNTERS(ADD_COUNTER)
+#undef ADD_COUNTER
+        // an upper bound: the threads need not peak at the same time
+        pool.peak += workers[i].peak;
+    }
+    free(workers);
+    workers = NULL;
+    self = NULL;
+}
+
+// How far a result is reduced: to normal form, to head normal form (no
+// redex before the head variable, under the leading binders), or to weak
+// head normal form (not under any binder). Set by --form.
+typedef enum {
+    FORM_NORMAL,
+    FORM_HEAD,
+    FORM_WEAK_HEAD,
+} normal_form;
+
+normal_form eval_form = FORM_NORMAL;
+
+// where a suspended call of eval resumes
+typedef enum {
+    EVAL_ENTER,
+    EVAL_RIGHT_DONE,    // the argument of the application has been reduced
+    EVAL_LEFT_DONE,     // the head of the application has been reduced again
+    EVAL_UNFOLDED,      // `unfolded`, a copy of a definition, has been reduced
+    EVAL_FORKED,        // the head has been reduced, the argument is `task`
+    EVAL_TAKEN_BACK,    // the argument, taken back from `task`, is reduced
+} eval_state;
+
+typedef struct {
+    term *tm;
+    term *unfolded;
+    symbol current_function;
+    eval_state state;
+    task *task;
+} eval_frame;
+
+_Thread_local STACK(eval_frame) eval_stack = {0};
+
+// Reduces `tm` in place, reducing arguments before they are substituted.
+// Unless --form asks for a normal form, `tm` itself is left at the first
+// abstraction it reduces to; what it is made of is reduced as always.
+// Returns true when it cannot make further progress. The continuation stack
+// lives on the heap, so the depth of a term is not limited by the C stack.
+bool eval(const table *functions, symbol current_function, term *tm) {
+    size_t base = eval_stack.len;
+    bool stuck = false;
+    PUSH(eval_stack, ((eval_frame){tm, NULL, current_function, EVAL_ENTER, NULL}));
+
+    while (eval_stack.len > base) {
+        eval_frame *frame = &TOP(eval_stack);
+        tm = frame->tm;
+        current_function = frame->current_function;
+
+        switch (frame->state) {
+        case EVAL_ENTER:
+            switch (tm->type) {
+            case TYPE_ABSTRACTION:
+                if ((eval_form != FORM_NORMAL && eval_stack.len == base + 1)
+                    || tm->value.abstraction.term->type == TYPE_VARIABLE) {
+                    stuck = true;
+                    eval_stack.len--;
+                } else {
+                    frame->tm = tm->value.abstraction.term;
+                }
+                break;
+            case TYPE_APPLICATION: {
+                term *left = tm->value.application.left;
+                term *right = tm->value.application.right;
+                // the head is reduced right after the argument unless it is
+                // an abstraction, so the two can be reduced at once
+                if (self != NULL && left->type != TYPE_ABSTRACTION
+                    && worth_forking(functions, right)) {
+                    frame->task = fork_task(functions, current_function, right);
+                }
+                if (frame->task != NULL) {
+                    frame->state = EVAL_FORKED;
+                    PUSH(eval_stack, ((eval_frame){left, NULL, current_function,
+                                              EVAL_ENTER, NULL}));
+                    break;
+                }
+                frame->state = EVAL_RIGHT_DONE;
+                PUSH(eval_stack, ((eval_frame){right, NULL, current_function,
+                                          EVAL_ENTER, NULL}));
+                break;
+            } case TYPE_VARIABLE: {
+                // detect recursion:
+                if (tm->value.var.gen == 0
+                    && tm->value.var.name == current_function) {
+                    fprintf(error_out(),
+                            "ERROR: Recursion detected in function `%s`.\n",
+                            symbol_name(current_function));
+                    give_up();
+                }
+                if (native_enabled && native_global(functions, tm)) {
+                    stuck = true;
+                    eval_stack.len--;
+                    break;
+                }
+                // only source-level names can refer to definitions
+                line_t *line = tm->value.var.gen != 0
+                    ? NULL : lookup(functions, tm->value.var.name);
+                if (line == NULL) {
+                    stuck = true;
+                    eval_stack.len--;
+                    break;
+                }
+                WORK(unfoldings);
+                if (profile_path != NULL) {
+                    profile_switch(profile_call(tm->origin,
+                                                tm->value.var.name));
+                }
+                packed *normal = __atomic_load_n(&line->normal,
+                                                 __ATOMIC_ACQUIRE);
+                if (normal != NULL && !native_enabled) {
+                    // reduced before, on its first use
+                    term *copy = unpack(normal, true);
+                    stats.memo_hits++;
+                    *tm = *copy;
+                    free_term(copy);
+                    stuck = false;
+                    eval_stack.len--;
+                    break;
+                }
+                term *unfolded = unpack(line->body, true);
+                frame->unfolded = unfolded;
+                frame->state = EVAL_UNFOLDED;
+                PUSH(eval_stack, ((eval_frame){unfolded, NULL, tm->value.var.name,
+                                          EVAL_ENTER, NULL}));
+                break;
+            } case TYPE_SHARED:
+                // thunks only exist under call-by-need
+                assert(false);
+                stuck = true;
+                eval_stack.len--;
+                break;
+            case TYPE_NATIVE:
+                stuck = true;
+                eval_stack.len--;
+                break;
+            }
+            break;
+        case EVAL_RIGHT_DONE:
+        case EVAL_LEFT_DONE: {
+            term *left = tm->value.application.left;
+            if (left->type != TYPE_ABSTRACTION) {
+                if (frame->state == EVAL_LEFT_DONE && stuck) {
+                    term *node;
+                    if (native_enabled
+                        && native_step(functions, tm, NULL, &node)
+                           == NATIVE_REDUCED) {
+                        // the argument is still reduced unless it was replaced
+                        frame->state = node == tm
+                            ? EVAL_ENTER : EVAL_RIGHT_DONE;
+                        break;
+                    }
+                    eval_stack.len--;
+                    break;
+                }
+                frame->state = EVAL_LEFT_DONE;
+                PUSH(eval_stack, ((eval_frame){left, NULL, current_function,
+                                          EVAL_ENTER, NULL}));
+                break;
+            }
+            substitute(tm);
+            frame->state = EVAL_ENTER;
+            break;
+        } case EVAL_UNFOLDED: {
+            // Keep the result for the next use of the name. It does not
+            // depend on where the name was met, since only names at
+            // generation 0 refer to definitions and no binder has that
+            // after cloning. A result with natives in it is not kept: the
+            // second pass of eval_line works on lambda terms only.
+            line_t *line = lookup(functions, tm->value.var.name);
+            if (!native_enabled
+                && __atomic_load_n(&line->normal, __ATOMIC_ACQUIRE) == NULL) {
+                // another thread may have kept its own result meanwhile
+                uint32_t base = profile_path == NULL ? NO_NODE
+                    : profile_child(tm->origin, tm->value.var.name);
+                packed *normal = pack(frame->unfolded, base);
+                packed *none = NULL;
+                if (!__atomic_compare_exchange_n(&line->normal, &none, normal,
+                                                 false, __ATOMIC_RELEASE,
+                                                 __ATOMIC_RELAXED)) {
+                    free(normal);
+                }
+            }
+            *tm = *frame->unfolded;
+            free_term(frame->unfolded);
+            stuck = false;
+            eval_stack.len--;
+            break;
+        } case EVAL_FORKED: {
+            task *t = frame->task;
+            if (take_back(t)) {
+                // reduce it here, on this eval_stack rather than the C eval_stack
+                t->head_stuck = stuck;
+                frame->state = EVAL_TAKEN_BACK;
+                PUSH(eval_stack, ((eval_frame){t->tm, NULL, current_function,
+                                          EVAL_ENTER, NULL}));
+                break;
+            }
+            // running other tasks meanwhile may move the eval_stack
+            wait_for(t);
+            frame = &TOP(eval_stack);
+            frame->task = NULL;
+            // both sides are reduced now, as after EVAL_LEFT_DONE
+            frame->state = EVAL_LEFT_DONE;
+            break;
+        } case EVAL_TAKEN_BACK:
+            stuck = frame->task->head_stuck;
+            finish_task(frame->task);
+            frame->task = NULL;
+            frame->state = EVAL_LEFT_DONE;
+            break;
+        }
+    }
+    return stuck;
+}
+
+// Call-by-need: arguments are not reduced before substitution. An argument
+// used more than once becomes a thunk shared by all its occurrences and is
+// reduced at most once, when something first needs its value.
+
+// Turns the head `tm` of a redex into an abstraction it owns, copying the
+// abstraction out of its thunk when that is still referenced elsewhere.
+// Returns false if the head is not an abstraction.
+bool own_abstraction(term *tm) {
+    if (tm->type != TYPE_SHARED) return tm->type == TYPE_ABSTRACTION;
+
+    term *value = deref(tm);
+    if (value->type != TYPE_ABSTRACTION) return false;
+
+    thunk *th = tm->value.shared;
+    if (th->refs == 1 && th->term == value) {
+        *tm = *value;
+        free_term(value);
+        slab_free(&pool.thunks, th);
+        return true;
+    }
+    term *copy = clone(value);
+    drop(th);
+    *tm = *copy;
+    free_term(copy);
+    return true;
+}
+
+// beta-reduces the redex `tm` without copying its argument
+void substitute_lazy(term *tm, bool open) {
+    static _Thread_local term_stack found = {0};
+    term *left  = tm->value.application.left;
+    term *right = tm->value.application.right;
+    term *body  = left->value.abstraction.term;
+
+    WORK(betas);
+    found.len = 0;
+    occurrences(body, left->value.abstraction.arg, &found);
+    if (found.len == 0) {
+        release(right);
+    } else if (found.len == 1 || right->type == TYPE_VARIABLE) {
+        update(&found, right);
+    } else {
+        // every occurrence becomes a reference to the same thunk
+        thunk *th;
+        if (right->type == TYPE_SHARED) {
+            th = right->value.shared;
+            th->refs += found.len - 1;
+            free_term(right);
+        } else {
+            th = new_thunk(right, found.len, open);
+        }
+        for (size_t i = 0; i < found.len; i++) {
+            found.items[i]->type = TYPE_SHARED;
+            found.items[i]->value.shared = th;
+        }
+    }
+
+    *tm = *body;
+    free_term(body);
+    free_term(left);
+}
+
+// where a suspended step of the call-by-need machine resumes
+typedef enum {
+    NEED_WHNF,          // reduce to weak head normal form
+    NEED_HEAD_DONE,     // the head of the application is in whnf
+    NEED_THUNK_DONE,    // the value of the thunk is in whnf
+    NEED_NORMALIZE,     // reduce to normal form
+    NEED_WHNF_DONE,     // the term is in whnf, normalize its parts
+    NEED_NORMAL_DONE,   // the value of `th` is in normal form
+} need_state;
+
+typedef struct {
+    term *tm;
+    thunk *th;
+    need_state state;
+    bool open;          // under a binder, thunks made here may be open
+    size_t forced;      // arguments of a native already in whnf
+    size_t layers;      // to normalize from here down, 0 for all
+} need_frame;
+
+_Thread_local STACK(need_frame) need_stack = {0};
+
+// Reduces `tm` in place, to weak head normal form if `goal` is NEED_WHNF.
+// With NEED_NORMALIZE, it goes on with the parts of the result, under
+// binders too, down to `layers` layers (0 for all). Thunks remember when
+// their value is normal so shared parts are only walked once.
+void reduce_need(const table *functions, term *tm, bool open,
+                 need_state goal, size_t layers) {
+    size_t base = need_stack.len;
+    PUSH(need_stack, ((need_frame){tm, NULL, goal, open, 0, layers}));
+
+    while (need_stack.len > base) {
+        need_frame *frame = &TOP(need_stack);
+        tm = frame->tm;
+        open = frame->open;
+
+        switch (frame->state) {
+        case NEED_WHNF:
+            switch (tm->type) {
+            case TYPE_ABSTRACTION:
+                need_stack.len--;
+                break;
+            case TYPE_APPLICATION:
+                frame->state = NEED_HEAD_DONE;
+                PUSH(need_stack, ((need_frame){tm->value.application.left, NULL,
+                                          NEED_WHNF, open, 0, 0}));
+                break;
+            case TYPE_VARIABLE: {
+                if (native_enabled && native_global(functions, tm)) {
+                    need_stack.len--;
+                    break;
+                }
+                const line_t *line = tm->value.var.gen != 0
+                    ? NULL : lookup(functions, tm->value.var.name);
+                if (line == NULL) {
+                    need_stack.len--;
+                    break;
+                }
+                check_recursion(line);
+                term *copy = unpack(line->body, true);
+                WORK(unfoldings);
+                *tm = *copy;
+                free_term(copy);
+                break;
+            } case TYPE_SHARED: {
+                thunk *th = tm->value.shared;
+                frame->state = NEED_THUNK_DONE;
+                PUSH(need_stack, ((need_frame){th->term, NULL,
+                                          NEED_WHNF, th->open, 0, 0}));
+                break;
+            } case TYPE_NATIVE:
+                need_stack.len--;
+                break;
+            }
+            break;
+        case NEED_HEAD_DONE:
+            if (native_enabled) {
+                term *node;
+                native_result res = native_step(functions, tm, &frame->forced,
+                                                &node);
+                if (res == NATIVE_FORCE) {
+                    PUSH(need_stack, ((need_frame){node, NULL, NEED_WHNF, open,
+                                              0, 0}));
+                    break;
+                }
+                frame->forced = 0;
+                if (res == NATIVE_REDUCED) {
+                    frame->state = NEED_WHNF;
+                    break;
+                }
+            }
+            if (!own_abstraction(tm->value.application.left)) {
+                need_stack.len--;
+                break;
+            }
+            substitute_lazy(tm, open);
+            frame->state = NEED_WHNF;
+            break;
+        case NEED_THUNK_DONE: {
+            thunk *th = tm->value.shared;
+            if (th->term->type == TYPE_VARIABLE
+                || th->term->type == TYPE_NATIVE) {
+                // a free name or a native, cheaper to copy than to share
+                term value = *th->term;
+                drop(th);
+                *tm = value;
+            }
+            need_stack.len--;
+            break;
+        } case NEED_NORMALIZE:
+            frame->state = NEED_WHNF_DONE;
+            PUSH(need_stack, ((need_frame){tm, NULL, NEED_WHNF, open, 0, 0}));
+            break;
+        case NEED_WHNF_DONE: {
+            size_t layers = frame->layers;
+            size_t below = layers == 0 ? 0 : layers - 1;
+            need_stack.len--;
+            if (layers == 1 && tm->type != TYPE_SHARED) break;
+            switch (tm->type) {
+            case TYPE_ABSTRACTION:
+                PUSH(need_stack, ((need_frame){tm->value.abstraction.term, NULL,
+                                          NEED_NORMALIZE, true, 0, below}));
+                break;
+            case TYPE_APPLICATION:
+                PUSH(need_stack, ((need_frame){tm->value.application.right, NULL,
+                                          NEED_NORMALIZE, open, 0, below}));
+                PUSH(need_stack, ((need_frame){tm->value.application.left, NULL,
+                                          NEED_NORMALIZE, open, 0, below}));
+                break;
+            case TYPE_VARIABLE:
+            case TYPE_NATIVE:
+                break;
+            case TYPE_SHARED: {
+                // the value is the same layer; only a whole one is normal
+                thunk *th = tm->value.shared;
+                if (th->normal) break;
+                if (layers == 0) {
+                    PUSH(need_stack, ((need_frame){NULL, th, NEED_NORMAL_DONE,
+                                              open, 0, 0}));
+                }
+                PUSH(need_stack, ((need_frame){th->term, NULL, NEED_NORMALIZE,
+                                          th->open, 0, layers}));
+                break;
+            }}
+            break;
+        } case NEED_NORMAL_DONE:
+            frame->th->normal = true;
+            need_stack.len--;
+            break;
+        }
+    }
+}
+
+void normalize(const table *functions, term *tm, bool open) {
+    reduce_need(functions, tm, open, NEED_NORMALIZE, 0);
+}
+
+void whnf(const table *functions, term *tm, bool open) {
+    reduce_need(functions, tm, open, NEED_WHNF, 0);
+}
+
+// copies a normal form out of its thunks into a plain tree
+term *expand(const term *tm) {
+    static _Thread_local STACK(clone_item) todo = {0};
+    term *root;
+    todo.len = 0;
+    PUSH(todo, ((clone_item){tm, &root, 0}));
+    while (todo.len > 0) {
+        clone_item item = POP(todo);
+        const term *src = deref((term*)item.src);
+        term *new = new_term();
+        *new = *src;
+        *item.dst = new;
+        switch (src->type) {
+        case TYPE_ABSTRACTION:
+            PUSH(todo, ((clone_item){src->value.abstraction.term,
+                                     &new->value.abstraction.term, 0}));
+            break;
+        case TYPE_APPLICATION:
+            PUSH(todo, ((clone_item){src->value.application.right,
+                                     &new->value.application.right, 0}));
+            PUSH(todo, ((clone_item){src->value.application.left,
+                                     &new->value.application.left, 0}));
+            break;
+        case TYPE_VARIABLE:
+        case TYPE_SHARED:
+        case TYPE_NATIVE:
+            break;
+        }
+    }
+    return root;
+}
+
+// Environment machine: instead of rewriting bodies, a lazy Krivine machine
+// runs a de Bruijn-indexed copy of the program. Closures capture their
+// environment, arguments are pushed as thunk cells that are updated with
+// their value the first time they are entered, and the normal form is read
+// back by applying abstractions to fresh free variables.
+
+typedef enum {
+    M_ABSTRACTION,
+    M_APPLICATION,
+    M_VARIABLE,     // bound, by de Bruijn index
+    M_GLOBAL,       // a top-level definition
+    M_FREE,         // a free name
+} mterm_type;
+
+typedef struct mterm {
+    mterm_type type;
+    union {
+        struct {
+            symbol arg;     // only used to name the variable on readback
+            struct mterm *body;
+        } abstraction;
+        struct {
+            struct mterm *left;
+            struct mterm *right;
+        } application;
+        size_t index;
+        symbol global;
+        variable free;
+    } value;
+} mterm;
+
+typedef struct {
+    const term *src;
+    mterm **dst;
+    size_t depth;
+} compile_item;
+
+// translates a term to the machine's representation
+mterm *compile(const table *functions, const term *tm) {
+    static _Thread_local STACK(compile_item) todo = {0};
+    static _Thread_local STACK(variable) scope = {0};
+    mterm *root;
+    todo.len = 0;
+    PUSH(todo, ((compile_item){tm, &root, 0}));
+    while (todo.len > 0) {
+        compile_item item = POP(todo);
+        const term *src = deref((term*)item.src);
+        mterm *new = allocate(sizeof(mterm));
+        *item.dst = new;
+        scope.len = item.depth;
+        switch (src->type) {
+        case TYPE_ABSTRACTION:
+            new->type = M_ABSTRACTION;
+            new->value.abstraction.arg = src->value.abstraction.arg.name;
+            PUSH(scope, src->value.abstraction.arg);
+            PUSH(todo, ((compile_item){src->value.abstraction.term,
+                                       &new->value.abstraction.body,
+                                       scope.len}));
+            break;
+        case TYPE_APPLICATION:
+            new->type = M_APPLICATION;
+            PUSH(todo, ((compile_item){src->value.application.right,
+                                       &new->value.application.right,
+                                       scope.len}));
+            PUSH(todo, ((compile_item){src->value.application.left,
+                                       &new->value.application.left,
+                                       scope.len}));
+            break;
+        case TYPE_VARIABLE: {
+            variable var = src->value.var;
+            size_t i = scope.len;
+            while (i > 0 && !var_eq(scope.items[i-1], var)) i--;
+            if (i > 0) {
+                new->type = M_VARIABLE;
+                new->value.index = scope.len - i;
+            } else if (var.gen == 0 && contains(functions, var.name)) {
+                new->type = M_GLOBAL;
+                new->value.global = var.name;
+            } else {
+                new->type = M_FREE;
+                new->value.free = var;
+            }
+            break;
+        } case TYPE_SHARED:
+            // deref never stops at a thunk reference
+            assert(false);
+            break;
+        case TYPE_NATIVE:
+            // natives only exist under the substitution strategies
+            assert(false);
+            break;
+        }
+    }
+    return root;
+}
+
+// The code of a definition, compiled on its first use. Server threads may
+// race to compile it; all but the first throw their copy away. A definition
+// that uses itself is never compiled, so it is rejected on every entry.
+const mterm *line_code(const table *functions, line_t *line) {
+    mterm *code = __atomic_load_n(&line->code, __ATOMIC_ACQUIRE);
+    if (code != NULL) return code;
+    check_recursion(line);
+    mterm *none = NULL;
+    term *body = unpack(line->body, false);
+    code = compile(functions, body);
+    release(body);
+    if (!__atomic_compare_exchange_n(&line->code, &none, code, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        release_code(code);
+        code = none;
+    }
+    return code;
+}
+
+void release_code(mterm *code) {
+    static _Thread_local STACK(mterm*) todo = {0};
+    PUSH(todo, code);
+    while (todo.len > 0) {
+        code = POP(todo);
+        switch (code->type) {
+        case M_ABSTRACTION:
+            PUSH(todo, code->value.abstraction.body);
+            break;
+        case M_APPLICATION:
+            PUSH(todo, code->value.application.left);
+            PUSH(todo, code->value.application.right);
+            break;
+        case M_VARIABLE:
+        case M_GLOBAL:
+        case M_FREE:
+            break;
+        }
+        free(code);
+    }
+}
+
+typedef enum {
+    CELL_THUNK,     // `code` in `env`, not yet evaluated
+    CELL_CLOSURE,   // an abstraction `code` in `env`
+    CELL_NEUTRAL,   // the free variable `head` applied to `args`
+} cell_kind;
+
+struct env;
+
+typedef struct cell {
+    cell_kind kind;
+    size_t refs;
+    const mterm *code;  // tree code, or
+    const instr *pc;    // bytecode to run in `env`
+    struct env *env;
+    variable head;
+    struct cell **args;
+    size_t nargs;
+    thunk *normal;      // the read back normal form, once known
+} cell;
+
+typedef struct env {
+    cell *cell;
+    struct env *next;
+    size_t refs;
+} env;
+
+cell *new_cell(cell_kind kind, const mterm *code, env *env) {
+    cell *c = slab_alloc(&pool.cells, sizeof(cell));
+    WORK(allocations);
+    c->kind   = kind;
+    c->refs   = 1;
+    c->code   = code;
+    c->pc     = NULL;
+    c->env    = env;
+    c->nargs  = 0;
+    c->args   = NULL;
+    c->normal = NULL;
+    return c;
+}
+
+env *env_cons(cell *c, env *next) {
+    env *e = slab_alloc(&pool.envs, sizeof(env));
+    WORK(allocations);
+    e->cell = c;
+    e->next = next;
+    e->refs = 1;
+    return e;
+}
+
+cell *env_get(env *e, size_t index) {
+    while (index-- > 0) e = e->next;
+    return e->cell;
+}
+
+env *env_ref(env *e) {
+    if (e != NULL) e->refs++;
+    return e;
+}
+
+// drops a reference to a cell and/or an environment, freeing what dies
+void release_machine(cell *c, env *e) {
+    static _Thread_local STACK(cell*) cells = {0};
+    static _Thread_local STACK(env*) envs = {0};
+    if (c != NULL) PUSH(cells, c);
+    if (e != NULL) PUSH(envs, e);
+    while (cells.len > 0 || envs.len > 0) {
+        if (envs.len > 0) {
+            e = POP(envs);
+            if (--e->refs > 0) continue;
+            PUSH(cells, e->cell);
+            if (e->next != NULL) PUSH(envs, e->next);
+            slab_free(&pool.envs, e);
+            continue;
+        }
+        c = POP(cells);
+        if (--c->refs > 0) continue;
+        if (c->env != NULL) PUSH(envs, c->env);
+        for (size_t i = 0; i < c->nargs; i++) PUSH(cells, c->args[i]);
+        tracked_free(c->args);
+        if (c->normal != NULL) drop(c->normal);
+        slab_free(&pool.cells, c);
+    }
+}
+
+// overwrites `c` with the value `v`, which it now references too
+void update_cell(cell *c, const cell *v) {
+    env *old = c->env;
+    c->kind = v->kind;
+    c->code = v->code;
+    c->pc   = v->pc;
+    c->env  = env_ref(v->env);
+    c->head = v->head;
+    c->nargs = v->nargs;
+    c->args = NULL;
+    if (v->nargs > 0) {
+        c->args = tracked_resize(NULL, v->nargs * sizeof(cell*));
+        for (size_t i = 0; i < v->nargs; i++) {
+            c->args[i] = v->args[i];
+            c->args[i]->refs++;
+        }
+    }
+    if (old != NULL) release_machine(NULL, old);
+}
+
+// an entry on the machine stack: an argument, or a cell to update
+typedef struct {
+    cell *cell;
+    bool update;
+} mframe;
+
+_Thread_local STACK(mframe) machine_stack = {0};
+
+// Collects the arguments above `base` on the machine stack into the neutral
+// value `n`, updating the thunks it passes on the way.
+cell *finish_neutral(cell *n, size_t base) {
+    while (machine_stack.len > base) {
+        mframe top = POP(machine_stack);
+        if (top.update) {
+            update_cell(top.cell, n);
+            release_machine(top.cell, NULL);
+            continue;
+        }
+        n->args = tracked_resize(n->args, (n->nargs+1) * sizeof(cell*));
+        n->args[n->nargs++] = top.cell;
+    }
+    return n;
+}
+
+// Runs the machine on `code` in `e` until it reaches weak head normal form,
+// returning the value as a new cell. Entering `start`, if given, updates it.
+cell *run(const table *functions, const mterm *code, env *e, cell *start) {
+    size_t base = machine_stack.len;
+    env_ref(e);
+    if (start != NULL) {
+        start->refs++;
+        PUSH(machine_stack, ((mframe){start, true}));
+    }
+
+    for (;;) {
+        switch (code->type) {
+        case M_APPLICATION: {
+            const mterm *arg = code->value.application.right;
+            cell *c;
+            if (arg->type == M_VARIABLE) {
+                c = env_get(e, arg->value.index);
+                c->refs++;
+            } else {
+                c = new_cell(CELL_THUNK, arg, env_ref(e));
+            }
+            PUSH(machine_stack, ((mframe){c, false}));
+            code = code->value.application.left;
+            continue;
+        } case M_ABSTRACTION: {
+            cell value = {CELL_CLOSURE, 0, code, NULL, e, {0, 0}, NULL, 0, NULL};
+            if (machine_stack.len == base) return new_cell(CELL_CLOSURE, code, e);
+            mframe top = POP(machine_stack);
+            if (top.update) {
+                update_cell(top.cell, &value);
+                release_machine(top.cell, NULL);
+                continue;
+            }
+            e = env_cons(top.cell, e);
+            WORK(betas);
+            code = code->value.abstraction.body;
+            continue;
+        } case M_GLOBAL: {
+            line_t *line = lookup(functions, code->value.global);
+            WORK(unfoldings);
+            release_machine(NULL, e);
+            e = NULL;
+            code = line_code(functions, line);
+            continue;
+        } case M_VARIABLE: {
+            cell *c = env_get(e, code->value.index);
+            if (c->kind == CELL_THUNK) {
+                c->refs++;
+                PUSH(machine_stack, ((mframe){c, true}));
+                env *next = env_ref(c->env);
+                code = c->code;
+                release_machine(NULL, e);
+                e = next;
+                continue;
+            }
+            if (c->kind == CELL_CLOSURE) {
+                // `c` may only be alive through `e`
+                env *next = env_ref(c->env);
+                code = c->code;
+                release_machine(NULL, e);
+                e = next;
+                continue;
+            }
+            // a neutral value: copy it so more arguments can be added
+            cell *n = new_cell(CELL_NEUTRAL, NULL, NULL);
+            update_cell(n, c);
+            release_machine(NULL, e);
+            return finish_neutral(n, base);
+        } case M_FREE: {
+            cell *n = new_cell(CELL_NEUTRAL, NULL, NULL);
+            n->head = code->value.free;
+            release_machine(NULL, e);
+            return finish_neutral(n, base);
+        }}
+    }
+}
+
+// Bytecode machine: the same lazy machine, but each definition is compiled
+// to a flat array of instructions instead of a tree. An application pushes
+// its arguments and falls through to the code of its head; the code of an
+// argument that is not a variable is placed after the rest and referenced
+// by a relative offset.
+typedef enum {
+    OP_PUSH_VAR,        // index:   push the cell bound at `index`
+    OP_PUSH_CODE,       // offset:  push a thunk for the code at pc+offset
+    OP_GRAB,            // symbol:  bind the argument on top of the stack
+    OP_ACCESS,          // index:   continue with the cell bound at `index`
+    OP_GLOBAL,          // symbol:  continue with a top-level definition
+    OP_FREE,            // symbol, generation: a free variable
+} opcode;
+
+// an argument whose code is yet to be emitted
+typedef struct {
+    const term *src;
+    size_t patch;       // where the offset to its code goes
+    size_t depth;
+} emit_item;
+
+// de Bruijn index of `var` in `scope`, or SIZE_MAX if it is not bound there
+size_t bound_index(const variable *scope, size_t len, variable var) {
+    for (size_t i = len; i-- > 0;) {
+        if (var_eq(scope[i], var)) return len-1 - i;
+    }
+    return SIZE_MAX;
+}
+
+instr *compile_bytecode(const table *functions, const term *tm) {
+    static _Thread_local STACK(emit_item) todo = {0};
+    static _Thread_local STACK(variable) scope = {0};
+    STACK(instr) code = {0};
+    todo.len = 0;
+    PUSH(todo, ((emit_item){tm, SIZE_MAX, 0}));
+    while (todo.len > 0) {
+        emit_item item = POP(todo);
+        if (item.patch != SIZE_MAX) {
+            // relative to the PUSH_CODE instruction
+            code.items[item.patch] = code.len - (item.patch-1);
+        }
+        scope.len = item.depth;
+        tm = deref((term*)item.src);
+        for (;;) {
+            if (tm->type == TYPE_APPLICATION) {
+                // push the arguments, last first, then run the head
+                for (; tm->type == TYPE_APPLICATION;
+                     tm = deref(tm->value.application.left)) {
+                    const term *arg = deref(tm->value.application.right);
+                    size_t index = arg->type != TYPE_VARIABLE ? SIZE_MAX
+                        : bound_index(scope.items, scope.len, arg->value.var);
+                    if (index != SIZE_MAX) {
+                        PUSH(code, OP_PUSH_VAR);
+                        PUSH(code, index);
+                    } else {
+                        PUSH(code, OP_PUSH_CODE);
+                        PUSH(code, 0);
+                        PUSH(todo, ((emit_item){arg, code.len-1, scope.len}));
+                    }
+                }
+                continue;
+            }
+            if (tm->type == TYPE_ABSTRACTION) {
+                PUSH(code, OP_GRAB);
+                PUSH(code, tm->value.abstraction.arg.name);
+                PUSH(scope, tm->value.abstraction.arg);
+                tm = deref(tm->value.abstraction.term);
+                continue;
+            }
+            variable var = tm->value.var;
+            size_t index = bound_index(scope.items, scope.len, var);
+            if (index != SIZE_MAX) {
+                PUSH(code, OP_ACCESS);
+                PUSH(code, index);
+            } else if (var.gen == 0 && contains(functions, var.name)) {
+                PUSH(code, OP_GLOBAL);
+                PUSH(code, var.name);
+            } else {
+                PUSH(code, OP_FREE);
+                PUSH(code, var.name);
+                PUSH(code, var.gen);
+            }
+            break;
+        }
+    }
+    return code.items;
+}
+
+// the bytecode of a definition, compiled on its first use like line_code
+const instr *line_bytecode(const table *functions, line_t *line) {
+    instr *code = __atomic_load_n(&line->bytecode, __ATOMIC_ACQUIRE);
+    if (code != NULL) return code;
+    check_recursion(line);
+    instr *none = NULL;
+    term *body = unpack(line->body, false);
+    code = compile_bytecode(functions, body);
+    release(body);
+    if (!__atomic_compare_exchange_n(&line->bytecode, &none, code, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(code);
+        code = none;
+    }
+    return code;
+}
+
+// Runs the bytecode at `pc` in `e` until it reaches weak head normal form,
+// returning the value as a new cell. Entering `start`, if given, updates it.
+cell *run_bytecode(const table *functions, const instr *pc, env *e,
+                   cell *start) {
+    size_t base = machine_stack.len;
+    env_ref(e);
+    if (start != NULL) {
+        start->refs++;
+        PUSH(machine_stack, ((mframe){start, true}));
+    }
+
+    for (;;) {
+        switch ((opcode)*pc) {
+        case OP_PUSH_VAR: {
+            cell *c = env_get(e, pc[1]);
+            c->refs++;
+            PUSH(machine_stack, ((mframe){c, false}));
+            pc += 2;
+            continue;
+        } case OP_PUSH_CODE: {
+            cell *c = new_cell(CELL_THUNK, NULL, env_ref(e));
+            c->pc = pc + pc[1];
+            PUSH(machine_stack, ((mframe){c, false}));
+            pc += 2;
+            continue;
+        } case OP_GRAB: {
+            if (machine_stack.len == base) {
+                cell *c = new_cell(CELL_CLOSURE, NULL, e);
+                c->pc = pc;
+                return c;
+            }
+            mframe top = POP(machine_stack);
+            if (top.update) {
+                cell value = {CELL_CLOSURE, 0, NULL, pc, e, {0, 0},
+                              NULL, 0, NULL};
+                update_cell(top.cell, &value);
+                release_machine(top.cell, NULL);
+                continue;
+            }
+            e = env_cons(top.cell, e);
+            WORK(betas);
+            pc += 2;
+            continue;
+        } case OP_ACCESS: {
+            cell *c = env_get(e, pc[1]);
+            if (c->kind == CELL_NEUTRAL) {
+                // copy it so more arguments can be added
+                cell *n = new_cell(CELL_NEUTRAL, NULL, NULL);
+                update_cell(n, c);
+                release_machine(NULL, e);
+                return finish_neutral(n, base);
+            }
+            if (c->kind == CELL_THUNK) {
+                c->refs++;
+                PUSH(machine_stack, ((mframe){c, true}));
+            }
+            // `c` may only be alive through `e`
+            env *next = env_ref(c->env);
+            pc = c->pc;
+            release_machine(NULL, e);
+            e = next;
+            continue;
+        } case OP_GLOBAL: {
+            line_t *line = lookup(functions, pc[1]);
+            WORK(unfoldings);
+            release_machine(NULL, e);
+            e = NULL;
+            pc = line_bytecode(functions, line);
+            continue;
+        } case OP_FREE: {
+            cell *n = new_cell(CELL_NEUTRAL, NULL, NULL);
+            n->head.name = pc[1];
+            n->head.gen  = pc[2];
+            release_machine(NULL, e);
+            return finish_neutral(n, base);
+        }}
+    }
+}
+
+// a value still to be read back, and where to put the result
+typedef struct {
+    cell *cell;
+    term **dst;
+} readback_item;
+
+// reads a cell back as a term in normal form, reducing under binders
+term *readback(const table *functions, cell *c) {
+    static _Thread_local STACK(readback_item) todo = {0};
+    term *root;
+    c->refs++;
+    todo.len = 0;
+    PUSH(todo, ((readback_item){c, &root}));
+    while (todo.len > 0) {
+        readback_item item = POP(todo);
+        c = item.cell;
+        if (c->kind == CELL_THUNK && c->pc != NULL) {
+            release_machine(run_bytecode(functions, c->pc, c->env, c), NULL);
+        } else if (c->kind == CELL_THUNK) {
+            release_machine(run(functions, c->code, c->env, c), NULL);
+        }
+        if (c->normal != NULL) {
+            term *ref = new_term();
+            ref->type = TYPE_SHARED;
+            ref->value.shared = c->normal;
+            c->normal->refs++;
+            *item.dst = ref;
+            release_machine(c, NULL);
+            continue;
+        }
+        term **dst = item.dst;
+        if (c->refs > 1) {
+            // read back once, however many places refer to it
+            c->normal = new_thunk(NULL, 2, true);
+            c->normal->normal = true;
+            term *ref = new_term();
+            ref->type = TYPE_SHARED;
+            ref->value.shared = c->normal;
+            *dst = ref;
+            dst = &c->normal->term;
+        }
+        if (c->kind == CELL_CLOSURE) {
+            term *abs = new_term();
+            abs->type = TYPE_ABSTRACTION;
+            abs->value.abstraction.arg = fresh(c->pc != NULL
+                                               ? c->pc[1]
+                                               : c->code->value.abstraction.arg);
+            *dst = abs;
+            cell *var = new_cell(CELL_NEUTRAL, NULL, NULL);
+            var->head = abs->value.abstraction.arg;
+            env *e = env_cons(var, env_ref(c->env));
+            cell *body = c->pc != NULL
+                ? run_bytecode(functions, c->pc + 2, e, NULL)
+                : run(functions, c->code->value.abstraction.body, e, NULL);
+            release_machine(NULL, e);
+            PUSH(todo, ((readback_item){body, &abs->value.abstraction.term}));
+        } else {
+            // the head applied to its arguments, innermost first
+            for (size_t i = c->nargs; i-- > 0;) {
+                term *app = new_term();
+                app->type = TYPE_APPLICATION;
+                *dst = app;
+                c->args[i]->refs++;
+                PUSH(todo, ((readback_item){c->args[i],
+                                            &app->value.application.right}));
+                dst = &app->value.application.left;
+            }
+            term *head = new_term();
+            head->type = TYPE_VARIABLE;
+            head->value.var = c->head;
+            *dst = head;
+        }
+        release_machine(c, NULL);
+    }
+    return root;
+}
+
+// normalizes `tm` on the environment machine
+term *eval_machine(const table *functions, const term *tm) {
+    mterm *code = compile(functions, tm);
+    cell *value = run(functions, code, NULL, NULL);
+    double start = timer_start();
+    term *shared = readback(functions, value);
+    term *result = expand(shared);
+    release(shared);
+    timer_stop(start, &stats.readback_time);
+    release_machine(value, NULL);
+    release_code(code);
+    return result;
+}
+
+// normalizes `tm` on the bytecode machine
+term *eval_bytecode(const table *functions, const term *tm) {
+    instr *code = compile_bytecode(functions, tm);
+    cell *value = run_bytecode(functions, code, NULL, NULL);
+    double start = timer_start();
+    term *shared = readback(functions, value);
+    term *result = expand(shared);
+    release(shared);
+    timer_stop(start, &stats.readback_time);
+    release_machine(value, NULL);
+    free(code);
+    return result;
+}
+
+// Ahead-of-time compilation to C. The definitions `main` uses are compiled
+// to bytecode as for --strategy=bytecode, and each instruction becomes a
+// statement of a C function of the definition, which switches on the place
+// the machine resumes at: the start of the definition or of an argument's
+// code, and an abstraction before and after it binds its argument. A
+// definition with many arguments' code is split over several functions of
+// at most C_PLACES places each, so no function is too big for the C compiler
+// however big the program is. A function returns the place to go on at, and
+// the loop of `run` finds the function of that place in a table, or enters
+// the variable it returned. The runtime in front of them holds the machine's
+// cells, the readback and the printing of `main`.
+
+#define C_PLACES 64
+
+const char *const c_runtime[] = {
+    "#include <stdint.h>",
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <stdbool.h>",
+    "#include <string.h>",
+    "",
+    "// The lazy Krivine machine of --strategy=bytecode, with every definition",
+    "// compiled to C below. Cells and environments live in an arena that is",
+    "// never freed: the program computes one normal form and exits.",
+    "",
+    "typedef enum { THUNK, CLOSURE, NEUTRAL } cell_kind;",
+    "",
+    "struct env;",
+    "",
+    "typedef struct cell {",
+    "    cell_kind kind;",
+    "    uint32_t pc;            // the code of a thunk or closure",
+    "    uint32_t name;          // the binder of a closure, or a neutral head",
+    "    uint32_t gen;           // the generation of a neutral head",
+    "    struct env *env;",
+    "    struct cell **args;     // what a neutral head is applied to",
+    "    size_t nargs;",
+    "    struct node *normal;    // the read back normal form, once known",
+    "} cell;",
+    "",
+    "typedef struct env {",
+    "    cell *cell;",
+    "    struct env *next;",
+    "} env;",
+    "",
+    "typedef enum { ABSTRACTION, APPLICATION, VARIABLE } node_kind;",
+    "",
+    "// a node of the normal form; shared parts are read back once",
+    "typedef struct node {",
+    "    node_kind kind;",
+    "    uint32_t name;",
+    "    uint32_t gen;",
+    "    struct node *left;      // the body, or the function applied",
+    "    struct node *right;",
+    "} node;",
+    "",
+    "#define STACK(type) struct { type *items; size_t len; size_t cap; }",
+    "#define PUSH(s, x) do {                                         \\",
+    "        if ((s).len == (s).cap) {                               \\",
+    "            (s).cap = (s).cap == 0 ? 64 : (s).cap * 2;          \\",
+    "            (s).items = realloc((s).items,                      \\",
+    "                                (s).cap * sizeof(*(s).items));  \\",
+    "            if ((s).items == NULL) out_of_memory();             \\",
+    "        }                                                       \\",
+    "        (s).items[(s).len++] = (x);                             \\",
+    "    } while (0)",
+    "#define POP(s) ((s).items[--(s).len])",
+    "",
+    "// What the compiled code does at every instruction is kept out of line,",
+    "// so that it stays a call each and the C compiler gets through a big",
+    "// program.",
+    "#ifdef __GNUC__",
+    "#define OUT_OF_LINE __attribute__((noinline))",
+    "#else",
+    "#define OUT_OF_LINE",
+    "#endif",
+    "",
+    "void out_of_memory(void) {",
+    "    fprintf(stderr, \"ERROR: out of memory\\n\");",
+    "    exit(1);",
+    "}",
+    "",
+    "char *arena_next = NULL;",
+    "char *arena_end = NULL;",
+    "",
+    "void *allocate(size_t size) {",
+    "    size = (size + 15) & ~(size_t)15;",
+    "    if ((size_t)(arena_end - arena_next) < size) {",
+    "        size_t chunk = size > ((size_t)1 << 24) ? size : (size_t)1 << 24;",
+    "        arena_next = malloc(chunk);",
+    "        if (arena_next == NULL) out_of_memory();",
+    "        arena_end = arena_next + chunk;",
+    "    }",
+    "    void *p = arena_next;",
+    "    arena_next += size;",
+    "    return p;",
+    "}",
+    "",
+    "OUT_OF_LINE cell *new_cell(cell_kind kind, uint32_t pc, env *e) {",
+    "    cell *c = allocate(sizeof(cell));",
+    "    c->kind = kind;",
+    "    c->pc = pc;",
+    "    c->name = 0;",
+    "    c->gen = 0;",
+    "    c->env = e;",
+    "    c->args = NULL;",
+    "    c->nargs = 0;",
+    "    c->normal = NULL;",
+    "    return c;",
+    "}",
+    "",
+    "env *env_cons(cell *c, env *next) {",
+    "    env *e = allocate(sizeof(env));",
+    "    e->cell = c;",
+    "    e->next = next;",
+    "    return e;",
+    "}",
+    "",
+    "OUT_OF_LINE cell *env_get(env *e, size_t index) {",
+    "    while (index-- > 0) e = e->next;",
+    "    return e->cell;",
+    "}",
+    "",
+    "// an entry on the machine stack: an argument, or a cell to update",
+    "typedef struct {",
+    "    cell *cell;",
+    "    bool update;",
+    "} frame;",
+    "",
+    "STACK(frame) stack = {0};",
+    "",
+    "OUT_OF_LINE void push(cell *c, bool update) {",
+    "    PUSH(stack, ((frame){c, update}));",
+    "}",
+    "",
+    "// overwrites the thunk `c` with the value `v`",
+    "void update_cell(cell *c, const cell *v) {",
+    "    node *normal = c->normal;",
+    "    *c = *v;",
+    "    c->normal = normal;",
+    "}",
+    "",
+    "// Binds the argument on top of the stack for the abstraction at `pc`, or",
+    "// returns it as a closure when there is none above `base`.",
+    "cell *grab(env **e, size_t base, uint32_t pc, uint32_t name) {",
+    "    cell value = {CLOSURE, pc, name, 0, *e, NULL, 0, NULL};",
+    "    while (stack.len > base) {",
+    "        frame top = POP(stack);",
+    "        if (!top.update) {",
+    "            *e = env_cons(top.cell, *e);",
+    "            return NULL;",
+    "        }",
+    "        update_cell(top.cell, &value);",
+    "    }",
+    "    cell *c = new_cell(CLOSURE, pc, *e);",
+    "    c->name = name;",
+    "    return c;",
+    "}",
+    "",
+    "// Applies the neutral value `n` to the arguments above `base`, updating",
+    "// the thunks it passes on the way.",
+    "cell *finish_neutral(const cell *n, size_t base) {",
+    "    static STACK(cell*) args = {0};",
+    "    args.len = 0;",
+    "    for (size_t i = 0; i < n->nargs; i++) PUSH(args, n->args[i]);",
+    "    cell *value = new_cell(NEUTRAL, 0, NULL);",
+    "    value->name = n->name;",
+    "    value->gen = n->gen;",
+    "    for (;;) {",
+    "        value->nargs = args.len;",
+    "        value->args = allocate(args.len * sizeof(cell*));",
+    "        memcpy(value->args, args.items, args.len * sizeof(cell*));",
+    "        if (stack.len == base) return value;",
+    "        frame top = POP(stack);",
+    "        if (top.update) {",
+    "            update_cell(top.cell, value);",
+    "        } else {",
+    "            PUSH(args, top.cell);",
+    "        }",
+    "    }",
+    "}",
+    "",
+    "// the registers of a running machine",
+    "typedef struct {",
+    "    env *e;",
+    "    cell *c;            // the cell to enter or return",
+    "    size_t base;        // the stack below it is a caller's",
+    "} machine;",
+    "",
+    "// what the code of a place returns other than the place to go on at",
+    "#define ENTER  UINT32_MAX           // enter the cell `c`",
+    "#define RETURN (UINT32_MAX - 1)     // return the cell `c`",
+    "",
+    "typedef uint32_t code(machine *m, uint32_t pc);",
+    "",
+    "extern code *const places[];",
+    "",
+    "cell *run(uint32_t pc, env *e, cell *start) {",
+    "    machine m = {e, NULL, stack.len};",
+    "    if (start != NULL) push(start, true);",
+    "    for (;;) {",
+    "        pc = places[pc](&m, pc);",
+    "        if (pc == RETURN) return m.c;",
+    "        if (pc != ENTER) continue;",
+    "        // a variable: run a thunk and update it, or enter a closure",
+    "        if (m.c->kind == NEUTRAL) return finish_neutral(m.c, m.base);",
+    "        if (m.c->kind == THUNK) push(m.c, true);",
+    "        pc = m.c->pc;",
+    "        m.e = m.c->env;",
+    "    }",
+    "}",
+    "",
+    "extern const char *const names[];",
+    "",
+    "// a value still to be read back, and where to put the result",
+    "typedef struct {",
+    "    cell *cell;",
+    "    node **dst;",
+    "} readback_item;",
+    "",
+    "uint32_t generation = 0;",
+    "",
+    "node *new_node(node_kind kind, uint32_t name, uint32_t gen) {",
+    "    node *n = allocate(sizeof(node));",
+    "    n->kind = kind;",
+    "    n->name = name;",
+    "    n->gen = gen;",
+    "    return n;",
+    "}",
+    "",
+    "// reads a cell back as a term in normal form, reducing under binders",
+    "node *readback(cell *c) {",
+    "    static STACK(readback_item) todo = {0};",
+    "    node *root;",
+    "    PUSH(todo, ((readback_item){c, &root}));",
+    "    while (todo.len > 0) {",
+    "        readback_item item = POP(todo);",
+    "        c = item.cell;",
+    "        if (c->kind == THUNK) run(c->pc, c->env, c);",
+    "        if (c->normal != NULL) {",
+    "            *item.dst = c->normal;",
+    "            continue;",
+    "        }",
+    "        if (c->kind == CLOSURE) {",
+    "            node *abs = new_node(ABSTRACTION, c->name, ++generation);",
+    "            *item.dst = c->normal = abs;",
+    "            cell *var = new_cell(NEUTRAL, 0, NULL);",
+    "            var->name = abs->name;",
+    "            var->gen = abs->gen;",
+    "            cell *body = run(c->pc + 2, env_cons(var, c->env), NULL);",
+    "            PUSH(todo, ((readback_item){body, &abs->left}));",
+    "            continue;",
+    "        }",
+    "        // the head applied to its arguments, innermost first",
+    "        node **dst = item.dst;",
+    "        for (size_t i = c->nargs; i-- > 0;) {",
+    "            node *app = new_node(APPLICATION, 0, 0);",
+    "            *dst = app;",
+    "            PUSH(todo, ((readback_item){c->args[i], &app->right}));",
+    "            dst = &app->left;",
+    "        }",
+    "        *dst = new_node(VARIABLE, c->name, c->gen);",
+    "        c->normal = *item.dst;",
+    "    }",
+    "    return root;",
+    "}",
+    "",
+    "// Output is gathered in a buffer and written in large pieces.",
+    "char out_buffer[1 << 16];",
+    "size_t out_len = 0;",
+    "",
+    "void out_flush(void) {",
+    "    fwrite(out_buffer, 1, out_len, stdout);",
+    "    out_len = 0;",
+    "}",
+    "",
+    "void out_text(const char *text) {",
+    "    for (; *text != '\\0'; text++) {",
+    "        if (out_len == sizeof(out_buffer)) out_flush();",
+    "        out_buffer[out_len++] = *text;",
+    "    }",
+    "}",
+    "",
+    "// Binders are named as the evaluator names them: with their own",
+    "// name, unless a binder around them is printed the same or a free",
+    "// name is spelled like it, then with the first of `x1`, `x2`, ...",
+    "// that is neither. Spellings are counted in a table that only grows.",
+    "typedef struct {",
+    "    char *text;",
+    "    uint32_t uses;      // binders in scope printed so, or a free name",
+    "    uint32_t next;      // the first suffix worth trying after this name",
+    "} spelling;",
+    "",
+    "spelling *spellings = NULL;",
+    "size_t spelling_cap = 0;        // always a power of two",
+    "size_t spelling_len = 0;",
+    "",
+    "size_t hash_text(const char *text) {",
+    "    size_t hash = 14695981039346656037ULL;",
+    "    for (; *text != '\\0'; text++) {",
+    "        hash ^= (unsigned char)*text;",
+    "        hash *= 1099511628211ULL;",
+    "    }",
+    "    return hash;",
+    "}",
+    "",
+    "spelling *spelling_of(const char *text) {",
+    "    if (2 * (spelling_len + 1) > spelling_cap) {",
+    "        size_t cap = spelling_cap == 0 ? 64 : spelling_cap * 2;",
+    "        spelling *table = allocate(cap * sizeof(spelling));",
+    "        memset(table, 0, cap * sizeof(spelling));",
+    "        for (size_t i = 0; i < spelling_cap; i++) {",
+    "            if (spellings[i].text == NULL) continue;",
+    "            size_t h = hash_text(spellings[i].text);",
+    "            while (table[h & (cap-1)].text != NULL) h++;",
+    "            table[h & (cap-1)] = spellings[i];",
+    "        }",
+    "        spellings = table;",
+    "        spelling_cap = cap;",
+    "    }",
+    "    for (size_t h = hash_text(text);; h++) {",
+    "        spelling *s = &spellings[h & (spelling_cap-1)];",
+    "        if (s->text == NULL) {",
+    "            s->text = allocate(strlen(text) + 1);",
+    "            strcpy(s->text, text);",
+    "            spelling_len++;",
+    "            return s;",
+    "        }",
+    "        if (strcmp(s->text, text) == 0) return s;",
+    "    }",
+    "}",
+    "",
+    "// what each binder is printed as, and its suffix, by generation",
+    "spelling **printed = NULL;",
+    "uint32_t *suffixes = NULL;",
+    "",
+    "void name_binder(const node *b) {",
+    "    static char *text = NULL;",
+    "    static size_t cap = 0;",
+    "    spelling *base = spelling_of(names[b->name]);",
+    "    spelling *s = base;",
+    "    uint32_t k = 0;",
+    "    if (s->uses > 0) {",
+    "        size_t len = strlen(names[b->name]) + 16;",
+    "        if (len > cap) {",
+    "            cap = len;",
+    "            text = allocate(cap);",
+    "        }",
+    "        for (k = base->next == 0 ? 1 : base->next;; k++) {",
+    "            snprintf(text, cap, \"%s%u\", names[b->name], k);",
+    "            s = spelling_of(text);",
+    "            if (s->uses == 0) break;",
+    "        }",
+    "        base->next = k + 1;",
+    "    }",
+    "    s->uses++;",
+    "    printed[b->gen] = s;",
+    "    suffixes[b->gen] = k;",
+    "}",
+    "",
+    "void leave_binder(const node *b) {",
+    "    printed[b->gen]->uses--;",
+    "    uint32_t k = suffixes[b->gen];",
+    "    if (k == 0) return;",
+    "    spelling *base = spelling_of(names[b->name]);",
+    "    if (k < base->next) base->next = k;",
+    "}",
+    "",
+    "// takes the names of the free variables of `n`",
+    "void take_free_names(const node *n) {",
+    "    static STACK(const node*) todo = {0};",
+    "    PUSH(todo, n);",
+    "    while (todo.len > 0) {",
+    "        n = POP(todo);",
+    "        if (n->kind == VARIABLE) {",
+    "            if (n->gen == 0) spelling_of(names[n->name])->uses = 1;",
+    "            continue;",
+    "        }",
+    "        if (n->kind == APPLICATION) PUSH(todo, n->right);",
+    "        PUSH(todo, n->left);",
+    "    }",
+    "}",
+    "",
+    "// a pending piece of output: a fixed string, a node, or neither where",
+    "// the scope of the binder on top of `scope` ends",
+    "typedef struct {",
+    "    const char *text;",
+    "    const node *node;",
+    "} dump_item;",
+    "",
+    "void dump(const node *n) {",
+    "    static STACK(dump_item) todo = {0};",
+    "    static STACK(const node*) scope = {0};",
+    "    printed = allocate((generation + 1) * sizeof(spelling*));",
+    "    suffixes = allocate((generation + 1) * sizeof(uint32_t));",
+    "    take_free_names(n);",
+    "    PUSH(todo, ((dump_item){NULL, n}));",
+    "    while (todo.len > 0) {",
+    "        dump_item item = POP(todo);",
+    "        if (item.text != NULL) {",
+    "            out_text(item.text);",
+    "            continue;",
+    "        }",
+    "        n = item.node;",
+    "        if (n == NULL) {",
+    "            leave_binder(POP(scope));",
+    "            continue;",
+    "        }",
+    "        switch (n->kind) {",
+    "        case ABSTRACTION:",
+    "            name_binder(n);",
+    "            PUSH(scope, n);",
+    "            out_text(\"\\\\\");",
+    "            out_text(printed[n->gen]->text);",
+    "            out_text(\".\");",
+    "            PUSH(todo, ((dump_item){NULL, NULL}));",
+    "            PUSH(todo, ((dump_item){NULL, n->left}));",
+    "            break;",
+    "        case APPLICATION:",
+    "            out_text(\"(\");",
+    "            PUSH(todo, ((dump_item){\")\", NULL}));",
+    "            PUSH(todo, ((dump_item){NULL, n->right}));",
+    "            PUSH(todo, ((dump_item){\")(\", NULL}));",
+    "            PUSH(todo, ((dump_item){NULL, n->left}));",
+    "            break;",
+    "        case VARIABLE:",
+    "            out_text(n->gen == 0",
+    "                     ? names[n->name] : printed[n->gen]->text);",
+    "            break;",
+    "        }",
+    "    }",
+    "    out_text(\"\\n\");",
+    "    out_flush();",
+    "}",
+    "",
+    "// prints the normal form, decoded as a number or a boolean if the type",
+    "// of `main` asks for it and it has that shape",
+    "void print_result(const node *t, int type) {",
+    "    if (type == 1 && t->kind == ABSTRACTION",
+    "        && t->left->kind == ABSTRACTION) {",
+    "        const node *body = t->left->left;",
+    "        unsigned long long i = 0;",
+    "        while (body->kind == APPLICATION",
+    "               && body->left->kind == VARIABLE",
+    "               && body->left->name == t->name",
+    "               && body->left->gen == t->gen) {",
+    "            body = body->right;",
+    "            i++;",
+    "        }",
+    "        if (body->kind == VARIABLE && body->name == t->left->name",
+    "            && body->gen == t->left->gen) {",
+    "            printf(\"%llu\\n\", i);",
+    "            return;",
+    "        }",
+    "    }",
+    "    if (type == 2 && t->kind == ABSTRACTION",
+    "        && t->left->kind == ABSTRACTION",
+    "        && t->left->left->kind == VARIABLE) {",
+    "        const node *body = t->left->left;",
+    "        if (body->name == t->name && body->gen == t->gen) {",
+    "            printf(\"true\\n\");",
+    "            return;",
+    "        }",
+    "        if (body->name == t->left->name && body->gen == t->left->gen) {",
+    "            printf(\"false\\n\");",
+    "            return;",
+    "        }",
+    "    }",
+    "    dump(t);",
+    "}",
+};
+
+// a definition to compile, and where its code starts among the cases
+typedef struct {
+    line_t *line;
+    instr *code;
+    size_t base;
+} c_definition;
+
+typedef struct {
+    STACK(c_definition) defs;
+    size_t *def_index;      // in `defs` of each slot of the table, or none
+    STACK(size_t) blocks;   // of the definition at hand
+    STACK(size_t) places;   // where the machine resumes
+    STACK(size_t) place_code;   // the function of each place
+    STACK(symbol) names;    // in the order they are written out
+    uint32_t *name_index;   // in `names` of each symbol, or UINT32_MAX
+} c_program;
+
+// Finds the offsets of the blocks in `code`, the first one and those pushed
+// as arguments. Returns the length of the code.
+size_t c_blocks(c_program *p, const instr *code) {
+    size_t end = 0;
+    p->blocks.len = 0;
+    PUSH(p->blocks, 0);
+    for (size_t i = 0; i < p->blocks.len; i++) {
+        size_t pc = p->blocks.items[i];
+        for (;;) {
+            opcode op = code[pc];
+            if (op == OP_PUSH_CODE) PUSH(p->blocks, pc + code[pc+1]);
+            pc += op == OP_FREE ? 3 : 2;
+            if (op == OP_ACCESS || op == OP_GLOBAL || op == OP_FREE) break;
+        }
+        if (pc > end) end = pc;
+    }
+    return end;
+}
+
+// writes `text` as a C string literal
+void c_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (; *text != '\0'; text++) {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < ' ' || c > '~') {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// the index of `name` in the table of names written out, adding it
+uint32_t c_name(c_program *p, symbol name) {
+    if (p->name_index[name] == UINT32_MAX) {
+        p->name_index[name] = p->names.len;
+        PUSH(p->names, name);
+    }
+    return p->name_index[name];
+}
+
+// the definition `name`, adding it to those to compile
+c_definition *c_definition_of(c_program *p, const table *functions,
+                              symbol name) {
+    line_t *line = lookup(functions, name);
+    size_t *index = &p->def_index[line - functions->slots];
+    if (*index == SIZE_MAX) {
+        *index = p->defs.len;
+        PUSH(p->defs, ((c_definition){line, NULL, 0}));
+    }
+    return &p->defs.items[*index];
+}
+
+// writes `main_line` and the definitions it uses to `path` as a C program
+void compile_c(const table *functions, line_t *main_line, const char *path) {
+    c_program p = {0};
+    p.def_index = allocate((functions->cap + 1) * sizeof(size_t));
+    for (size_t i = 0; i <= functions->cap; i++) p.def_index[i] = SIZE_MAX;
+    p.name_index = allocate(symbols.len * sizeof(uint32_t));
+    for (size_t i = 0; i < symbols.len; i++) p.name_index[i] = UINT32_MAX;
+
+    // main first, so that its code starts at place 0
+    size_t cases = 0;
+    c_definition_of(&p, functions, main_line->name);
+    for (size_t d = 0; d < p.defs.len; d++) {
+        check_recursion(p.defs.items[d].line);
+        term *body = unpack(p.defs.items[d].line->body, false);
+        instr *code = compile_bytecode(functions, body);
+        release(body);
+        p.defs.items[d].code = code;
+        p.defs.items[d].base = cases;
+        cases += c_blocks(&p, code);
+        for (size_t b = 0; b < p.blocks.len; b++) {
+            // only the last instruction of a block can be longer than two
+            for (size_t pc = p.blocks.items[b];; pc += 2) {
+                if (code[pc] == OP_GLOBAL) {
+                    c_definition_of(&p, functions, code[pc+1]);
+                }
+                if (code[pc] == OP_ACCESS || code[pc] == OP_GLOBAL
+                    || code[pc] == OP_FREE) {
+                    break;
+                }
+            }
+        }
+    }
+    if (cases >= UINT32_MAX - 1) {
+        fprintf(stderr, "ERROR: the program is too big to compile\n");
+        exit(1);
+    }
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: could not open file: %s (ERRNO %d)\n",
+                strerror(errno), errno);
+        exit(1);
+    }
+    for (size_t i = 0; i < sizeof(c_runtime) / sizeof(*c_runtime); i++) {
+        fprintf(out, "%s\n", c_runtime[i]);
+    }
+
+    size_t functions_written = 0;
+    for (size_t d = 0; d < p.defs.len; d++) {
+        const instr *code = p.defs.items[d].code;
+        size_t base = p.defs.items[d].base;
+        fprintf(out, "\n// %s\n", symbol_name(p.defs.items[d].line->name));
+        c_blocks(&p, code);
+        size_t first = p.places.len;    // of the function being written
+        for (size_t b = 0; b < p.blocks.len; b++) {
+            if (b == 0 || p.places.len - first >= C_PLACES) {
+                if (b > 0) fprintf(out, "    }\n    abort();\n}\n\n");
+                fprintf(out, "uint32_t code_%zu(machine *m, uint32_t pc) {\n"
+                        "    switch (pc) {\n", functions_written++);
+                first = p.places.len;
+            }
+            size_t pc = p.blocks.items[b];
+            size_t labelled = pc;   // the last offset given a case
+            fprintf(out, "    case %zu:\n", base + pc);
+            PUSH(p.places, base + pc);
+            for (;; pc += code[pc] == OP_FREE ? 3 : 2) {
+                const instr *ip = &code[pc];
+                switch ((opcode)*ip) {
+                case OP_PUSH_VAR:
+                    fprintf(out, "        push(env_get(m->e, %u), false);\n",
+                            ip[1]);
+                    continue;
+                case OP_PUSH_CODE:
+                    fprintf(out, "        push(new_cell(THUNK, %zu, m->e),"
+                            " false);\n", base + pc + ip[1]);
+                    continue;
+                case OP_GRAB:
+                    if (pc != labelled) {
+                        fprintf(out, "        // fall through\n"
+                                "    case %zu:\n", base + pc);
+                        PUSH(p.places, base + pc);
+                    }
+                    fprintf(out, "        m->c = grab(&m->e, m->base, %zu, %u);"
+                            "\n"
+                            "        if (m->c != NULL) return RETURN;\n"
+                            "        // fall through\n"
+                            "    case %zu:\n", base + pc,
+                            c_name(&p, ip[1]), base + pc + 2);
+                    PUSH(p.places, base + pc + 2);
+                    labelled = pc + 2;
+                    continue;
+                case OP_ACCESS:
+                    fprintf(out, "        m->c = env_get(m->e, %u);\n"
+                            "        return ENTER;\n", ip[1]);
+                    break;
+                case OP_GLOBAL: {
+                    c_definition *def = c_definition_of(&p, functions, ip[1]);
+                    fprintf(out, "        m->e = NULL;\n"
+                            "        return %zu;\n", def->base);
+                    break;
+                } case OP_FREE:
+                    fprintf(out, "        m->c = new_cell(NEUTRAL, 0, NULL);\n"
+                            "        m->c->name = %u;\n"
+                            "        m->c->gen = %u;\n"
+                            "        m->c = finish_neutral(m->c, m->base);\n"
+                            "        return RETURN;\n",
+                            c_name(&p, ip[1]), ip[2]);
+                    break;
+                }
+                break;
+            }
+            while (p.place_code.len < p.places.len) {
+                PUSH(p.place_code, functions_written - 1);
+            }
+        }
+        fprintf(out, "    }\n    abort();\n}\n");
+    }
+
+    fprintf(out, "\ncode *const places[] = {\n");
+    for (size_t i = 0; i < p.places.len; i++) {
+        fprintf(out, "    [%zu] = code_%zu,\n", p.places.items[i],
+                p.place_code.items[i]);
+    }
+    fprintf(out, "};\n");
+
+    fprintf(out, "\nconst char *const names[] = {\n");
+    for (size_t i = 0; i < p.names.len; i++) {
+        fprintf(out, "    ");
+        c_string(out, symbol_name(p.names.items[i]));
+        fprintf(out, ",\n");
+    }
+    if (p.names.len == 0) fprintf(out, "    \"\",\n");
+    fprintf(out, "};\n\n"
+            "int main(void) {\n"
+            "    print_result(readback(run(0, NULL, NULL)), %d);\n"
+            "    return 0;\n"
+            "}\n",
+            main_line->type == TYPE_INT ? 1
+            : main_line->type == TYPE_BOOL ? 2 : 0);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "ERROR: could not write file: %s (ERRNO %d)\n",
+                strerror(errno), errno);
+        exit(1);
+    }
+
+    for (size_t d = 0; d < p.defs.len; d++) free(p.defs.items[d].code);
+    free(p.defs.items);
+    free(p.def_index);
+    free(p.blocks.items);
+    free(p.places.items);
+    free(p.place_code.items);
+    free(p.names.items);
+    free(p.name_index);
+}
+
+// Optimal reduction on interaction nets. A term is translated to a sharing
+// graph in the style of Lamping's algorithm, with the brackets and croissants
+// of Gonthier, Abadi and Levy: every node carries a level, fans share a part
+// of the graph between two places, and the control nodes keep the levels
+// consistent as shared parts pass through each other. A redex is reduced once
+// however many copies of it the result holds, so sharing lost by copying
+// arguments into every occurrence is never paid for.
+//
+// Two nodes interact when their principal ports meet. Nodes of the same kind
+// and level annihilate (an application meeting an abstraction is a beta
+// reduction), an eraser eats whatever it meets, and otherwise the node on the
+// lower level passes through the other, changing its level: a croissant
+// lowers what it passes and a bracket raises it. A bracket stands for a
+// chain of `lift` of them on the levels from its own up, each wired by its
+// principal port to the auxiliary port of the one below, so that an
+// occurrence nested deep below its binder takes one node rather than one per
+// level, and what passes it is raised by `lift` at once.
+
+typedef enum {
+    NET_LAMBDA,     // principal, body, binder
+    NET_APP,        // function (principal), result, argument
+    NET_FAN,        // principal, two copies
+    NET_CROISSANT,  // principal, one auxiliary port
+    NET_BRACKET,    // principal, one auxiliary port, and a lift
+    NET_ERASER,     // principal only
+    NET_ROOT,       // the term, at port 1
+    NET_FREE,       // a free name, at port 1
+    NET_DEAD,       // on the free list
+} net_kind;
+
+const int net_ports[] = {
+    [NET_LAMBDA] = 3, [NET_APP] = 3, [NET_FAN] = 3,
+    [NET_CROISSANT] = 2, [NET_BRACKET] = 2, [NET_ERASER] = 1,
+};
+
+typedef uint32_t net_port;      // node index << 2 | port number
+
+#define NET_PORT(node, i) ((net_port)(node) << 2 | (i))
+#define NET_NODE(p)       ((p) >> 2)
+#define NET_SLOT(p)       ((int)((p) & 3))
+#define NET_NONE          UINT32_MAX
+#define NET_MAX_NODES     (1u << 30)
+
+typedef struct {
+    net_kind kind;
+    uint32_t level;
+    uint32_t lift;          // the levels a bracket raises what passes it by
+    variable var;           // the binder of an abstraction, or a free name
+    net_port ports[3];      // the port each one is wired to
+} net_node;
+
+typedef struct {
+    net_node *nodes;        // one flat buffer, reused by every evaluation
+    size_t len;
+    size_t cap;
+    uint32_t free;          // dead nodes, linked through their port 0
+    STACK(uint32_t) redexes;    // nodes whose principal port may be active
+} net_t;
+
+_Thread_local net_t net = {0};
+
+_Noreturn void net_stuck(void) {
+    fprintf(error_out(), "ERROR: the interaction net got stuck\n");
+    give_up();
+}
+
+uint32_t net_alloc(net_kind kind, uint32_t level) {
+    uint32_t n;
+    if (net.free != NET_NONE) {
+        n = net.free;
+        net.free = net.nodes[n].ports[0];
+    } else {
+        if (net.len == NET_MAX_NODES) {
+            fprintf(stderr, "ERROR: the interaction net is too big\n");
+            exit(1);
+        }
+        if (net.len == net.cap) {
+            net.cap = net.cap == 0 ? 1024 : net.cap * 2;
+            net.nodes = reallocate(net.nodes, net.cap * sizeof(net_node));
+        }
+        n = net.len++;
+    }
+    net.nodes[n].kind = kind;
+    net.nodes[n].level = level;
+    net.nodes[n].lift = 1;
+    WORK(allocations);
+    return n;
+}
+
+void net_kill(uint32_t n) {
+    net.nodes[n].kind = NET_DEAD;
+    net.nodes[n].ports[0] = net.free;
+    net.free = n;
+}
+
+net_port net_peer(net_port p) {
+    return net.nodes[NET_NODE(p)].ports[NET_SLOT(p)];
+}
+
+// Wires two ports together. The rules below wire new ports to the old
+// neighbours of the nodes they replace; when a neighbour is itself a port
+// being replaced, it is wired to the new port first and passes it on when its
+// own turn comes, which also takes care of wires looping back to the pair.
+void net_link(net_port a, net_port b) {
+    net.nodes[NET_NODE(a)].ports[NET_SLOT(a)] = b;
+    net.nodes[NET_NODE(b)].ports[NET_SLOT(b)] = a;
+    if (NET_SLOT(a) == 0 && NET_SLOT(b) == 0) PUSH(net.redexes, NET_NODE(a));
+}
+
+// whether the principal port of `n` meets that of another node
+bool net_active(uint32_t n) {
+    if (net.nodes[n].kind >= NET_ROOT) return false;
+    net_port p = net.nodes[n].ports[0];
+    return NET_SLOT(p) == 0 && net.nodes[NET_NODE(p)].kind < NET_ROOT;
+}
+
+// the level a node at `level` gets after a control node passes through it
+uint32_t net_adjust(const net_node *control, uint32_t level) {
+    switch (control->kind) {
+    case NET_CROISSANT: return level - 1;
+    case NET_BRACKET:   return level + control->lift;
+    default:            return level;
+    }
+}
+
+// joins the neighbours of the auxiliary ports of `a` and `b` pairwise
+void net_annihilate(uint32_t a, uint32_t b) {
+    for (int i = 1; i < net_ports[net.nodes[a].kind]; i++) {
+        net_link(net_peer(NET_PORT(a, i)), net_peer(NET_PORT(b, i)));
+    }
+    net_kill(a);
+    net_kill(b);
+}
+
+// erases `n`, which meets the eraser `e` at port `q`
+void net_erase(uint32_t e, uint32_t n, int q) {
+    for (int i = 0; i < net_ports[net.nodes[n].kind]; i++) {
+        if (i == q) continue;
+        uint32_t copy = net_alloc(NET_ERASER, 0);
+        net_link(NET_PORT(copy, 0), net_peer(NET_PORT(n, i)));
+    }
+    net_kill(e);
+    net_kill(n);
+}
+
+// Lets `a` and `b`, which meet at ports `qa` and `qb`, pass through each
+// other: `a` is copied onto every other port of `b` and the other way round.
+// The copies of the node on the higher level take the level the lower one
+// gives them.
+void net_commute(uint32_t a, int qa, uint32_t b, int qb) {
+    net_node x = net.nodes[a];
+    net_node y = net.nodes[b];
+    if (x.level < y.level) {
+        y.level = net_adjust(&x, y.level);
+    } else if (y.level < x.level) {
+        x.level = net_adjust(&y, x.level);
+    } else {
+        net_stuck();
+    }
+    // Two control nodes only trade places, so they are moved rather than
+    // copied, unless their other ports are wired to each other.
+    if (qa == 0 && qb == 0 && net_ports[x.kind] == 2
+        && net_ports[y.kind] == 2 && net_peer(NET_PORT(a, 1)) != NET_PORT(b, 1)) {
+        net_port pa = net_peer(NET_PORT(a, 1));
+        net_port pb = net_peer(NET_PORT(b, 1));
+        net.nodes[a].level = x.level;
+        net.nodes[b].level = y.level;
+        net_link(NET_PORT(a, 0), pb);
+        net_link(NET_PORT(b, 0), pa);
+        net_link(NET_PORT(a, 1), NET_PORT(b, 1));
+        return;
+    }
+    int ox[2], oy[2];       // the ports they do not meet at
+    int nx = 0, ny = 0;
+    for (int i = 0; i < net_ports[x.kind]; i++) if (i != qa) ox[nx++] = i;
+    for (int i = 0; i < net_ports[y.kind]; i++) if (i != qb) oy[ny++] = i;
+
+    uint32_t xs[2], ys[2];  // copies of `a` for the ports of `b`, and back
+    for (int j = 0; j < ny; j++) {
+        xs[j] = net_alloc(x.kind, x.level);
+        net.nodes[xs[j]].lift = x.lift;
+        net.nodes[xs[j]].var = x.var;
+    }
+    for (int i = 0; i < nx; i++) {
+        ys[i] = net_alloc(y.kind, y.level);
+        net.nodes[ys[i]].lift = y.lift;
+        net.nodes[ys[i]].var = y.var;
+    }
+    for (int j = 0; j < ny; j++) {
+        net_link(NET_PORT(xs[j], qa), net_peer(NET_PORT(b, oy[j])));
+    }
+    for (int i = 0; i < nx; i++) {
+        net_link(NET_PORT(ys[i], qb), net_peer(NET_PORT(a, ox[i])));
+    }
+    for (int i = 0; i < nx; i++) {
+        for (int j = 0; j < ny; j++) {
+            net_link(NET_PORT(xs[j], ox[i]), NET_PORT(ys[i], oy[j]));
+        }
+    }
+    net_kill(a);
+    net_kill(b);
+}
+
+// Two brackets on one level: the chains they stand for annihilate pairwise
+// as far as the shorter goes, and what is left of the longer one is wired to
+// where the shorter one led.
+void net_unbracket(uint32_t a, uint32_t b) {
+    if (net.nodes[a].lift == net.nodes[b].lift) {
+        net_annihilate(a, b);
+        return;
+    }
+    if (net.nodes[a].lift > net.nodes[b].lift) {
+        uint32_t t = a;
+        a = b;
+        b = t;
+    }
+    net_port pa = net_peer(NET_PORT(a, 1));
+    net.nodes[b].level += net.nodes[a].lift;
+    net.nodes[b].lift -= net.nodes[a].lift;
+    net_kill(a);
+    net_link(NET_PORT(b, 0), pa);
+}
+
+// rewrites the active pair of `a` and `b`
+void net_interact(uint32_t a, uint32_t b) {
+    WORK(interactions);
+    net_kind ka = net.nodes[a].kind;
+    net_kind kb = net.nodes[b].kind;
+    if (ka == NET_ERASER) {
+        net_erase(a, b, 0);
+    } else if (kb == NET_ERASER) {
+        net_erase(b, a, 0);
+    } else if (net.nodes[a].level != net.nodes[b].level) {
+        net_commute(a, 0, b, 0);
+    } else if (ka == NET_APP && kb == NET_LAMBDA) {
+        WORK(betas);
+        net_annihilate(a, b);
+    } else if (ka == NET_LAMBDA && kb == NET_APP) {
+        WORK(betas);
+        net_annihilate(b, a);
+    } else if (ka == NET_BRACKET && kb == NET_BRACKET) {
+        net_unbracket(a, b);
+    } else if (ka == kb && ka != NET_LAMBDA && ka != NET_APP) {
+        net_annihilate(a, b);
+    } else {
+        net_stuck();
+    }
+}
+
+// rewrites active pairs until there are none left
+void net_reduce(void) {
+    while (net.redexes.len > 0) {
+        uint32_t a = POP(net.redexes);
+        // entries go stale as nodes are rewritten; only live pairs count
+        if (!net_active(a)) continue;
+        net_interact(a, NET_NODE(net.nodes[a].ports[0]));
+    }
+}
+
+// a variable in scope while translating, and the binder it belongs to
+typedef struct {
+    variable var;
+    uint32_t binder;
+} net_scope;
+
+// where the occurrences of a variable are gathered
+typedef struct {
+    net_port port;      // the binder port of the abstraction
+    uint32_t level;
+    net_port top;       // the occurrences so far, or NET_NONE
+} net_binder;
+
+typedef struct {
+    const term *src;
+    net_port dst;       // where the top of its net is wired
+    uint32_t level;
+    size_t depth;       // of the scope
+} net_item;
+
+_Thread_local STACK(net_binder) net_binders = {0};
+
+// Wires an occurrence at `level` to its binder: a croissant marks the
+// occurrence, one bracket lifts it over every argument it is nested in below
+// the binder, and fans on the binder's level join the occurrences.
+void net_occurrence(uint32_t binder, uint32_t level, net_port dst) {
+    uint32_t c = net_alloc(NET_CROISSANT, level);
+    net_link(NET_PORT(c, 1), dst);
+    net_port top = NET_PORT(c, 0);
+    net_binder *b = &net_binders.items[binder];
+    if (level > b->level) {
+        uint32_t bracket = net_alloc(NET_BRACKET, b->level);
+        net.nodes[bracket].lift = level - b->level;
+        net_link(NET_PORT(bracket, 1), top);
+        top = NET_PORT(bracket, 0);
+    }
+    if (b->top == NET_NONE) {
+        b->top = top;
+        return;
+    }
+    uint32_t fan = net_alloc(NET_FAN, b->level);
+    net_link(NET_PORT(fan, 1), b->top);
+    net_link(NET_PORT(fan, 2), top);
+    b->top = NET_PORT(fan, 0);
+}
+
+typedef STACK(line_t*) line_stack;
+
+// appends the definitions `tm` refers to, as often as it does
+void net_uses(const table *functions, const term *tm, line_stack *uses) {
+    static _Thread_local STACK(net_item) todo = {0};
+    static _Thread_local STACK(variable) scope = {0};
+    todo.len = 0;
+    PUSH(todo, ((net_item){tm, 0, 0, 0}));
+    while (todo.len > 0) {
+        net_item item = POP(todo);
+        scope.len = item.depth;
+        const term *src = item.src;
+        switch (src->type) {
+        case TYPE_ABSTRACTION:
+            PUSH(scope, src->value.abstraction.arg);
+            PUSH(todo, ((net_item){src->value.abstraction.term, 0, 0,
+                                   scope.len}));
+            break;
+        case TYPE_APPLICATION:
+            PUSH(todo, ((net_item){src->value.application.right, 0, 0,
+                                   scope.len}));
+            PUSH(todo, ((net_item){src->value.application.left, 0, 0,
+                                   scope.len}));
+            break;
+        case TYPE_VARIABLE: {
+            variable var = src->value.var;
+            size_t i = scope.len;
+            while (i > 0 && !var_eq(scope.items[i-1], var)) i--;
+            line_t *line = i > 0 || var.gen != 0
+                ? NULL : lookup(functions, var.name);
+            if (line != NULL) PUSH(*uses, line);
+            break;
+        } default:
+            // natives and thunks only exist under the other strategies
+            assert(false);
+            break;
+        }
+    }
+}
+
+typedef struct {
+    line_t *line;
+    size_t next;        // its first use not looked at yet
+    size_t end;
+} net_visit;
+
+// Lists the definitions `tm` uses, directly or not, each after the ones it
+// uses itself. A definition that depends on itself is an error, as in eval.
+void net_globals(const table *functions, const term *tm, line_stack *order) {
+    static _Thread_local line_stack uses = {0};
+    static _Thread_local STACK(net_visit) visits = {0};
+    static _Thread_local uint8_t *marks = NULL;     // 1 visiting, 2 listed
+    marks = reallocate(marks, functions->cap + 1);
+    memset(marks, 0, functions->cap + 1);
+
+    uses.len = 0;
+    net_uses(functions, tm, &uses);
+    PUSH(visits, ((net_visit){NULL, 0, uses.len}));
+    while (visits.len > 0) {
+        net_visit *visit = &TOP(visits);
+        if (visit->next == visit->end) {
+            line_t *done = visit->line;
+            visits.len--;
+            if (done != NULL) {
+                marks[done - functions->slots] = 2;
+                PUSH(*order, done);
+            }
+            uses.len = visits.len > 0 ? TOP(visits).end : 0;
+            continue;
+        }
+        line_t *line = uses.items[visit->next++];
+        uint8_t *mark = &marks[line - functions->slots];
+        if (*mark == 2) continue;
+        if (*mark == 1) {
+            visits.len = 0;
+            fprintf(error_out(),
+                    "ERROR: Recursion detected in function `%s`.\n",
+                    symbol_name(line->name));
+            give_up();
+        }
+        *mark = 1;
+        size_t begin = uses.len;
+        const packed *body = line->body;
+        for (uint32_t i = 0; i < body->len; i++) {
+            if (body->tags[i] != PACKED_FREE || body->b[i] != 0) continue;
+            line_t *use = lookup(functions, body->a[i]);
+            if (use != NULL) PUSH(uses, use);
+        }
+        PUSH(visits, ((net_visit){line, begin, uses.len}));
+    }
+}
+
+// Translates `tm` to a net and returns its root. The definitions it uses
+// are bound around it on level 0, `(\name.tm) definition`, so each one is
+// translated once and shared between its uses.
+uint32_t net_translate(const table *functions, const term *tm) {
+    static _Thread_local STACK(net_item) todo = {0};
+    static _Thread_local STACK(net_scope) scope = {0};
+    static _Thread_local line_stack globals = {0};
+    static _Thread_local term_stack bodies = {0};
+    static _Thread_local uint32_t *global_binder = NULL;
+    // the bodies of the last call, in case it gave up halfway
+    while (bodies.len > 0) release(POP(bodies));
+    net.len = 0;
+    net.free = NET_NONE;
+    net.redexes.len = 0;
+    net_binders.len = 0;
+    todo.len = 0;
+    globals.len = 0;
+    net_globals(functions, tm, &globals);
+    global_binder = reallocate(global_binder,
+                               (functions->cap + 1) * sizeof(uint32_t));
+
+    uint32_t root = net_alloc(NET_ROOT, 0);
+    net_port dst = NET_PORT(root, 1);
+    for (size_t i = 0; i < globals.len; i++) {
+        line_t *line = globals.items[i];
+        uint32_t app = net_alloc(NET_APP, 0);
+        uint32_t lam = net_alloc(NET_LAMBDA, 0);
+        net.nodes[lam].var = (variable){line->name, 0};
+        net_link(NET_PORT(app, 1), dst);
+        net_link(NET_PORT(app, 0), NET_PORT(lam, 0));
+        global_binder[line - functions->slots] = net_binders.len;
+        PUSH(net_binders, ((net_binder){NET_PORT(lam, 2), 0, NET_NONE}));
+        PUSH(bodies, unpack(line->body, false));
+        PUSH(todo, ((net_item){TOP(bodies), NET_PORT(app, 2), 1, 0}));
+        dst = NET_PORT(lam, 1);
+        WORK(unfoldings);
+    }
+    PUSH(todo, ((net_item){tm, dst, 0, 0}));
+
+    while (todo.len > 0) {
+        net_item item = POP(todo);
+        const term *src = item.src;
+        scope.len = item.depth;
+        switch (src->type) {
+        case TYPE_ABSTRACTION: {
+            uint32_t lam = net_alloc(NET_LAMBDA, item.level);
+            net.nodes[lam].var = src->value.abstraction.arg;
+            net_link(NET_PORT(lam, 0), item.dst);
+            PUSH(scope, ((net_scope){src->value.abstraction.arg,
+                                     net_binders.len}));
+            PUSH(net_binders, ((net_binder){NET_PORT(lam, 2), item.level,
+                                            NET_NONE}));
+            PUSH(todo, ((net_item){src->value.abstraction.term,
+                                   NET_PORT(lam, 1), item.level, scope.len}));
+            break;
+        } case TYPE_APPLICATION: {
+            // arguments are one level deeper than the application
+            uint32_t app = net_alloc(NET_APP, item.level);
+            net_link(NET_PORT(app, 1), item.dst);
+            PUSH(todo, ((net_item){src->value.application.right,
+                                   NET_PORT(app, 2), item.level + 1,
+                                   scope.len}));
+            PUSH(todo, ((net_item){src->value.application.left,
+                                   NET_PORT(app, 0), item.level,
+                                   scope.len}));
+            break;
+        } case TYPE_VARIABLE: {
+            variable var = src->value.var;
+            size_t i = scope.len;
+            while (i > 0 && !var_eq(scope.items[i-1].var, var)) i--;
+            line_t *line = i > 0 || var.gen != 0
+                ? NULL : lookup(functions, var.name);
+            if (i > 0) {
+                net_occurrence(scope.items[i-1].binder, item.level, item.dst);
+            } else if (line != NULL) {
+                net_occurrence(global_binder[line - functions->slots],
+                               item.level, item.dst);
+            } else {
+                uint32_t free = net_alloc(NET_FREE, 0);
+                net.nodes[free].var = var;
+                net_link(NET_PORT(free, 1), item.dst);
+            }
+            break;
+        } default:
+            assert(false);
+            break;
+        }
+    }
+    while (bodies.len > 0) release(POP(bodies));
+
+    for (size_t i = 0; i < net_binders.len; i++) {
+        net_binder *b = &net_binders.items[i];
+        if (b->top != NET_NONE) {
+            net_link(b->port, b->top);
+        } else {
+            net_link(b->port, NET_PORT(net_alloc(NET_ERASER, 0), 0));
+        }
+    }
+    return root;
+}
+
+// Reading back walks the shared net from the root as it stands, carrying
+// the context of Gonthier, Abadi and Levy: one stack per level recording
+// which copy was taken at each fan on the way. Entering a fan at a copy
+// pushes it on the fan's level and entering at the principal port pops it,
+// a croissant adds or removes a level, and a bracket joins two levels into
+// a pair or splits one. A copy of an abstraction is told apart from the
+// others by the levels below its own, which pick the copy of every shared
+// part it sits in, so a variable is bound by the enclosing copy whose levels
+// agree with the ones it reaches the binder with.
+
+#define NET_EMPTY 0             // a level nothing was recorded on
+
+// a cell of a level: a copy taken and the cells below, or a pair of levels
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    bool pair;
+} net_cell;
+
+// an abstraction read back, and the context it was entered with
+typedef struct {
+    uint32_t node;
+    uint32_t context;
+    variable var;
+    uint32_t next;      // the enclosing one, or NET_NONE
+} net_instance;
+
+typedef struct {
+    net_port port;      // where the subterm is entered from above
+    uint32_t context;
+    uint32_t scope;     // the innermost enclosing abstraction
+    term **dst;
+} net_readback_item;
+
+_Thread_local STACK(net_cell) net_cells = {0};
+_Thread_local STACK(net_instance) net_instances = {0};
+// The context being followed, one level after another, and the ones saved
+// for later, each as its number of levels followed by them.
+_Thread_local STACK(uint32_t) net_context = {0};
+_Thread_local STACK(uint32_t) net_saved = {0};
+
+uint32_t net_cell_new(uint32_t head, uint32_t tail, bool pair) {
+    PUSH(net_cells, ((net_cell){head, tail, pair}));
+    return net_cells.len - 1;
+}
+
+uint32_t net_level(uint32_t i) {
+    return i < net_context.len ? net_context.items[i] : NET_EMPTY;
+}
+
+// replaces `drop` levels of the context from level `i` on by `levels`
+void net_splice(uint32_t i, uint32_t drop, const uint32_t *levels,
+                uint32_t count) {
+    while (net_context.len < i + drop) PUSH(net_context, NET_EMPTY);
+    size_t rest = net_context.len - i - drop;
+    while (net_context.len < i + count + rest) PUSH(net_context, NET_EMPTY);
+    uint32_t *at = &net_context.items[i];
+    memmove(at + count, at + drop, rest * sizeof(uint32_t));
+    memcpy(at, levels, count * sizeof(uint32_t));
+    net_context.len = i + count + rest;
+}
+
+uint32_t net_save(void) {
+    uint32_t saved = net_saved.len;
+    PUSH(net_saved, net_context.len);
+    for (size_t i = 0; i < net_context.len; i++) {
+        PUSH(net_saved, net_context.items[i]);
+    }
+    return saved;
+}
+
+void net_restore(uint32_t saved) {
+    net_context.len = 0;
+    for (uint32_t i = 0; i < net_saved.items[saved]; i++) {
+        PUSH(net_context, net_saved.items[saved + 1 + i]);
+    }
+}
+
+// whether two levels agree where both recorded something
+bool net_levels_match(uint32_t a, uint32_t b) {
+    static _Thread_local STACK(uint32_t) todo = {0};
+    todo.len = 0;
+    PUSH(todo, a);
+    PUSH(todo, b);
+    while (todo.len > 0) {
+        b = POP(todo);
+        a = POP(todo);
+        while (a != NET_EMPTY && b != NET_EMPTY) {
+            net_cell x = net_cells.items[a];
+            net_cell y = net_cells.items[b];
+            if (x.pair != y.pair) return false;
+            if (x.pair) {
+                PUSH(todo, x.tail);
+                PUSH(todo, y.tail);
+            } else if (x.head != y.head) {
+                return false;
+            }
+            a = x.pair ? x.head : x.tail;
+            b = y.pair ? y.head : y.tail;
+        }
+    }
+    return true;
+}
+
+// the variable of the copy of abstraction `node` whose binder the context
+// reached
+variable net_binder_of(uint32_t scope, uint32_t node) {
+    uint32_t level = net.nodes[node].level;
+    for (; scope != NET_NONE; scope = net_instances.items[scope].next) {
+        net_instance *in = &net_instances.items[scope];
+        if (in->node != node) continue;
+        uint32_t len = net_saved.items[in->context];
+        const uint32_t *levels = &net_saved.items[in->context + 1];
+        uint32_t i = 0;
+        for (; i < level; i++) {
+            uint32_t a = i < len ? levels[i] : NET_EMPTY;
+            if (!net_levels_match(a, net_level(i))) break;
+        }
+        if (i == level) return in->var;
+    }
+    net_stuck();
+}
+
+// Follows the wire entered at `*p` through fans and control nodes, updating
+// the context, until it reaches an abstraction, an application or a free
+// name.
+void net_follow(net_port *p) {
+    static _Thread_local STACK(uint32_t) lifted = {0};
+    for (;;) {
+        net_node *node = &net.nodes[NET_NODE(*p)];
+        uint32_t l = node->level;
+        uint32_t levels[2];
+        switch (node->kind) {
+        case NET_FAN:
+            if (NET_SLOT(*p) == 0) {
+                uint32_t top = net_level(l);
+                if (top == NET_EMPTY || net_cells.items[top].pair) {
+                    net_stuck();
+                }
+                levels[0] = net_cells.items[top].tail;
+                net_splice(l, 1, levels, 1);
+                *p = node->ports[net_cells.items[top].head];
+            } else {
+                levels[0] = net_cell_new(NET_SLOT(*p), net_level(l),
+                                         false);
+                net_splice(l, 1, levels, 1);
+                *p = node->ports[0];
+            }
+            break;
+        case NET_CROISSANT:
+            if (NET_SLOT(*p) == 0) {
+                net_splice(l, 1, levels, 0);
+                *p = node->ports[1];
+            } else {
+                levels[0] = NET_EMPTY;
+                net_splice(l, 0, levels, 1);
+                *p = node->ports[0];
+            }
+            break;
+        case NET_BRACKET:
+            // as many splits or joins as the brackets it stands for, the
+            // lowest one first on the way in and last on the way out
+            lifted.len = 0;
+            if (NET_SLOT(*p) == 0) {
+                uint32_t pair = net_level(l);
+                for (uint32_t i = 0; i < node->lift; i++) {
+                    if (pair == NET_EMPTY) {
+                        PUSH(lifted, NET_EMPTY);
+                    } else if (net_cells.items[pair].pair) {
+                        PUSH(lifted, net_cells.items[pair].head);
+                        pair = net_cells.items[pair].tail;
+                    } else {
+                        net_stuck();
+                    }
+                }
+                PUSH(lifted, pair);
+                net_splice(l, 1, lifted.items, lifted.len);
+                *p = node->ports[1];
+            } else {
+                uint32_t pair = net_level(l + node->lift);
+                for (uint32_t i = node->lift; i-- > 0;) {
+                    pair = net_cell_new(net_level(l + i), pair, true);
+                }
+                PUSH(lifted, pair);
+                net_splice(l, node->lift + 1, lifted.items, 1);
+                *p = node->ports[0];
+            }
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+// reads the normal form back as a term from the shared net
+term *net_readback(uint32_t root) {
+    static _Thread_local STACK(net_readback_item) todo = {0};
+    term *result;
+    net_cells.len = 0;
+    net_cell_new(0, 0, false);      // NET_EMPTY
+    net_instances.len = 0;
+    net_context.len = 0;
+    net_saved.len = 0;
+    todo.len = 0;
+    PUSH(todo, ((net_readback_item){net.nodes[root].ports[1], net_save(),
+                                    NET_NONE, &result}));
+    while (todo.len > 0) {
+        net_readback_item item = POP(todo);
+        net_restore(item.context);
+        net_follow(&item.port);
+        net_port p = item.port;
+        net_node *node = &net.nodes[NET_NODE(p)];
+        term *tm = new_term();
+        *item.dst = tm;
+        if (node->kind == NET_LAMBDA && NET_SLOT(p) == 0) {
+            tm->type = TYPE_ABSTRACTION;
+            tm->value.abstraction.arg = fresh(node->var.name);
+            uint32_t context = net_save();
+            PUSH(net_instances, ((net_instance){NET_NODE(p), context,
+                tm->value.abstraction.arg, item.scope}));
+            PUSH(todo, ((net_readback_item){node->ports[1], context,
+                net_instances.len - 1, &tm->value.abstraction.term}));
+        } else if (node->kind == NET_APP && NET_SLOT(p) == 1) {
+            tm->type = TYPE_APPLICATION;
+            uint32_t context = net_save();
+            PUSH(todo, ((net_readback_item){node->ports[2], context,
+                item.scope, &tm->value.application.right}));
+            PUSH(todo, ((net_readback_item){node->ports[0], context,
+                item.scope, &tm->value.application.left}));
+        } else if (node->kind == NET_LAMBDA && NET_SLOT(p) == 2) {
+            tm->type = TYPE_VARIABLE;
+            tm->value.var = net_binder_of(item.scope, NET_NODE(p));
+        } else if (node->kind == NET_FREE) {
+            tm->type = TYPE_VARIABLE;
+            tm->value.var = node->var;
+        } else {
+            net_stuck();
+        }
+    }
+    return result;
+}
+
+// normalizes `tm` by optimal reduction of its interaction net
+term *eval_net(const table *functions, const term *tm) {
+    uint32_t root = net_translate(functions, tm);
+    net_reduce();
+    double start = timer_start();
+    term *result = net_readback(root);
+    timer_stop(start, &stats.readback_time);
+    return result;
+}
+
+// Hash-consed normalization. Terms are a graph in which equal subterms, up to
+// the names of their binders, are one node: bound variables are de Bruijn
+// indices, and a node is only made after looking for an equal one. Each node
+// remembers its normal form once it is known, so a subterm that occurs again,
+// anywhere and at any time, is reduced once. Arguments are reduced before
+// they are substituted, as under the strict strategy, and a definition is
+// the node of its body, so unfolding it costs nothing. Each thread has a
+// store of its own, kept from one evaluation to the next until it holds
+// HC_KEEP_NODES nodes; the next evaluation then starts on an empty one, so a
+// server or a watch does not keep growing. A query that is abandoned drops
+// the store too, with whatever it had made.
+
+typedef enum {
+    HC_LAMBDA,      // a: the body, b: the name of the binder, for printing
+    HC_APP,         // a: the function, b: the argument
+    HC_BOUND,       // a: the de Bruijn index
+    HC_FREE,        // a: the name, b: the generation
+    HC_NAMED,       // a: the node of a definition, b: its name, which the
+                    // body of an abstraction keeps, as strict leaves it
+} hc_tag;
+
+#define HC_NONE      UINT32_MAX
+#define HC_BUSY      (UINT32_MAX - 1)   // a definition being made
+#define HC_MAX_NODES (UINT32_MAX - 1)
+#define HC_KEEP_NODES (1u << 20)
+
+typedef struct {
+    uint8_t tag;
+    uint8_t parents;    // the nodes it is a child of, counted up to 2
+    uint32_t a;
+    uint32_t b;
+    uint32_t free;      // one more than its greatest free index, 0 if none
+    uint32_t normal;    // its normal form, HC_NONE until it is known
+} hc_node;
+
+typedef struct {
+    STACK(hc_node) nodes;
+    uint32_t *slots;    // open addressing on the nodes, HC_NONE when empty
+    size_t slot_cap;    // always a power of two
+    STACK(uint32_t) globals;    // the node of each definition, by symbol
+} hc_store;
+
+_Thread_local hc_store hc = {0};
+
+uint64_t hc_hash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    return key ^ key >> 31;
+}
+
+// the hash of a node, which leaves out the name of a binder
+uint64_t hc_node_hash(uint8_t tag, uint32_t a, uint32_t b) {
+    if (tag == HC_LAMBDA) b = 0;
+    return hc_hash(((uint64_t)a << 32 | b) ^ (uint64_t)tag << 62);
+}
+
+void hc_grow(void) {
+    size_t cap = hc.slot_cap == 0 ? 1024 : hc.slot_cap * 2;
+    uint32_t *slots = allocate(cap * sizeof(uint32_t));
+    for (size_t i = 0; i < cap; i++) slots[i] = HC_NONE;
+    for (uint32_t id = 0; id < hc.nodes.len; id++) {
+        const hc_node *n = &hc.nodes.items[id];
+        size_t h = hc_node_hash(n->tag, n->a, n->b);
+        while (slots[h & (cap-1)] != HC_NONE) h++;
+        slots[h & (cap-1)] = id;
+    }
+    free(hc.slots);
+    hc.slots = slots;
+    hc.slot_cap = cap;
+}
+
+// the node with these fields, made unless there is one already
+uint32_t hc_make(uint8_t tag, uint32_t a, uint32_t b) {
+    if (2 * (hc.nodes.len + 1) > hc.slot_cap) hc_grow();
+    size_t mask = hc.slot_cap - 1;
+    size_t h = hc_node_hash(tag, a, b);
+    for (;; h++) {
+        uint32_t id = hc.slots[h & mask];
+        if (id == HC_NONE) break;
+        const hc_node *n = &hc.nodes.items[id];
+        if (n->tag == tag && n->a == a && (tag == HC_LAMBDA || n->b == b)) {
+            return id;
+        }
+    }
+    if (hc.nodes.len == HC_MAX_NODES) {
+        fprintf(stderr, "ERROR: the hash-consed graph is too big\n");
+        exit(1);
+    }
+    uint32_t id = hc.nodes.len;
+    hc_node n = {tag, 0, a, b, 0, HC_NONE};
+    switch (tag) {
+    case HC_LAMBDA: {
+        hc_node *body = &hc.nodes.items[a];
+        n.free = body->free > 0 ? body->free - 1 : 0;
+        if (body->parents < 2) body->parents++;
+        break;
+    } case HC_APP: {
+        hc_node *left = &hc.nodes.items[a];
+        hc_node *right = &hc.nodes.items[b];
+        n.free = left->free > right->free ? left->free : right->free;
+        if (left->parents < 2) left->parents++;
+        if (right->parents < 2) right->parents++;
+        break;
+    } case HC_BOUND:
+        n.free = a + 1;
+        n.normal = id;
+        break;
+    case HC_FREE:
+        n.normal = id;
+        break;
+    case HC_NAMED:
+        // a definition has no free index
+        break;
+    }
+    PUSH(hc.nodes, n);
+    hc.slots[h & mask] = id;
+    WORK(allocations);
+    return id;
+}
+
+// Results of one substitution or shift, by node and depth. Bumping the
+// stamp empties it without touching the entries.
+typedef struct {
+    uint64_t key;
+    uint32_t value;
+    uint32_t stamp;
+} hc_entry;
+
+typedef struct {
+    hc_entry *entries;
+    size_t cap;         // always a power of two
+    size_t len;
+    uint32_t stamp;     // entries with another stamp are empty
+} hc_memo;
+
+void hc_memo_clear(hc_memo *m) {
+    m->len = 0;
+    if (++m->stamp == 0) {
+        for (size_t i = 0; i < m->cap; i++) m->entries[i].stamp = 0;
+        m->stamp = 1;
+    }
+}
+
+bool hc_memo_get(const hc_memo *m, uint64_t key, uint32_t *value) {
+    if (m->cap == 0) return false;
+    for (size_t h = hc_hash(key);; h++) {
+        const hc_entry *e = &m->entries[h & (m->cap-1)];
+        if (e->stamp != m->stamp) return false;
+        if (e->key == key) {
+            *value = e->value;
+            return true;
+        }
+    }
+}
+
+void hc_memo_put(hc_memo *m, uint64_t key, uint32_t value) {
+    if (2 * (m->len + 1) > m->cap) {
+        size_t cap = m->cap == 0 ? 64 : m->cap * 2;
+        hc_entry *entries = allocate(cap * sizeof(hc_entry));
+        for (size_t i = 0; i < cap; i++) entries[i].stamp = 0;
+        for (size_t i = 0; i < m->cap; i++) {
+            hc_entry e = m->entries[i];
+            if (e.stamp != m->stamp) continue;
+            size_t h = hc_hash(e.key);
+            while (entries[h & (cap-1)].stamp == m->stamp) h++;
+            entries[h & (cap-1)] = e;
+        }
+        free(m->entries);
+        m->entries = entries;
+        m->cap = cap;
+    }
+    size_t h = hc_hash(key);
+    while (m->entries[h & (m->cap-1)].stamp == m->stamp) h++;
+    m->entries[h & (m->cap-1)] = (hc_entry){key, value, m->stamp};
+    m->len++;
+}
+
+#define HC_KEY(node, depth) ((uint64_t)(node) << 32 | (depth))
+
+// a node to rebuild `depth` binders below the root, or to build from the
+// rebuilt children on its way back
+typedef struct {
+    uint32_t node;
+    uint32_t depth;
+    bool built;
+} hc_item;
+
+uint32_t hc_subst(uint32_t body, uint32_t arg);
+
+_Thread_local STACK(hc_item) hc_todo = {0};
+_Thread_local STACK(uint32_t) hc_built = {0};
+
+// Rebuilds `tm`, replacing each free index: with `subst`, the index 0 by
+// `arg` and the others by one less, otherwise every index by `arg` more. A
+// subterm with no free index is left alone, and one with several parents is
+// rebuilt once at each depth; a node with one parent is only met once.
+uint32_t hc_rebuild(uint32_t tm, uint32_t arg, bool subst, hc_memo *memo) {
+    if (!subst && arg == 0) return tm;
+    size_t base = hc_todo.len;
+    PUSH(hc_todo, ((hc_item){tm, 0, false}));
+    while (hc_todo.len > base) {
+        hc_item item = POP(hc_todo);
+        hc_node n = hc.nodes.items[item.node];
+        uint64_t key = HC_KEY(item.node, item.depth);
+        uint32_t r;
+        if (item.built) {
+            if (n.tag == HC_LAMBDA) {
+                r = hc_make(HC_LAMBDA, POP(hc_built), n.b);
+            } else {
+                uint32_t right = POP(hc_built);
+                r = hc_make(HC_APP, POP(hc_built), right);
+            }
+            if (n.parents > 1) hc_memo_put(memo, key, r);
+            PUSH(hc_built, r);
+            continue;
+        }
+        if (n.free <= item.depth) {
+            PUSH(hc_built, item.node);
+            continue;
+        }
+        if (n.parents > 1 && n.tag != HC_BOUND
+            && hc_memo_get(memo, key, &r)) {
+            PUSH(hc_built, r);
+            continue;
+        }
+        switch (n.tag) {
+        case HC_LAMBDA:
+            PUSH(hc_todo, ((hc_item){item.node, item.depth, true}));
+            PUSH(hc_todo, ((hc_item){n.a, item.depth + 1, false}));
+            break;
+        case HC_APP:
+            PUSH(hc_todo, ((hc_item){item.node, item.depth, true}));
+            PUSH(hc_todo, ((hc_item){n.b, item.depth, false}));
+            PUSH(hc_todo, ((hc_item){n.a, item.depth, false}));
+            break;
+        case HC_BOUND:
+            // free in `tm`, since it is not below `depth`
+            if (!subst) {
+                r = hc_make(HC_BOUND, n.a + arg, 0);
+            } else if (n.a > item.depth) {
+                r = hc_make(HC_BOUND, n.a - 1, 0);
+            } else if (!hc_memo_get(memo, HC_KEY(HC_NONE, item.depth), &r)) {
+                // the argument, moved under the binders around the index
+                static _Thread_local hc_memo shifts = {0};
+                hc_memo_clear(&shifts);
+                r = hc_rebuild(arg, item.depth, false, &shifts);
+                hc_memo_put(memo, HC_KEY(HC_NONE, item.depth), r);
+            }
+            PUSH(hc_built, r);
+            break;
+        case HC_FREE:
+        case HC_NAMED:
+            // a free name or a definition has no free index
+            assert(false);
+            break;
+        }
+    }
+    return POP(hc_built);
+}
+
+// the body of an abstraction applied to `arg`
+uint32_t hc_subst(uint32_t body, uint32_t arg) {
+    static _Thread_local hc_memo substs = {0};
+    hc_memo_clear(&substs);
+    return hc_rebuild(body, arg, true, &substs);
+}
+
+typedef enum {
+    HC_ENTER,
+    HC_BODY_DONE,       // the body of the abstraction is normal
+    HC_FUNCTION_DONE,   // the function of the application is normal
+    HC_ARGUMENT_DONE,   // so is its argument, and `function` holds the first
+    HC_REDUCED,         // the redex has been reduced and that normalized
+} hc_state;
+
+typedef struct {
+    uint32_t node;
+    uint32_t function;
+    hc_state state;
+} hc_frame;
+
+// the normal form of `tm`, which each node it passes through remembers
+uint32_t hc_normalize(uint32_t tm) {
+    static _Thread_local STACK(hc_frame) stack = {0};
+    uint32_t result = HC_NONE;
+    stack.len = 0;
+    PUSH(stack, ((hc_frame){tm, HC_NONE, HC_ENTER}));
+    while (stack.len > 0) {
+        hc_frame *frame = &TOP(stack);
+        hc_node n = hc.nodes.items[frame->node];
+        switch (frame->state) {
+        case HC_ENTER:
+            if (n.normal != HC_NONE) {
+                if (n.tag == HC_APP) stats.memo_hits++;
+                result = n.normal;
+                stack.len--;
+            } else if (n.tag == HC_LAMBDA
+                       && hc.nodes.items[n.a].tag == HC_NAMED) {
+                // stuck, like an abstraction whose body is a name in eval
+                hc.nodes.items[frame->node].normal = frame->node;
+                result = frame->node;
+                stack.len--;
+            } else if (n.tag == HC_NAMED) {
+                frame->state = HC_REDUCED;
+                PUSH(stack, ((hc_frame){n.a, HC_NONE, HC_ENTER}));
+            } else if (n.tag == HC_LAMBDA) {
+                frame->state = HC_BODY_DONE;
+                PUSH(stack, ((hc_frame){n.a, HC_NONE, HC_ENTER}));
+            } else {
+                frame->state = HC_FUNCTION_DONE;
+                PUSH(stack, ((hc_frame){n.a, HC_NONE, HC_ENTER}));
+            }
+            break;
+        case HC_BODY_DONE:
+            result = hc_make(HC_LAMBDA, result, n.b);
+            hc.nodes.items[result].normal = result;
+            hc.nodes.items[frame->node].normal = result;
+            stack.len--;
+            break;
+        case HC_FUNCTION_DONE:
+            frame->function = result;
+            frame->state = HC_ARGUMENT_DONE;
+            PUSH(stack, ((hc_frame){n.b, HC_NONE, HC_ENTER}));
+            break;
+        case HC_ARGUMENT_DONE: {
+            const hc_node *function = &hc.nodes.items[frame->function];
+            if (function->tag == HC_LAMBDA) {
+                WORK(betas);
+                uint32_t reduct = hc_subst(function->a, result);
+                frame->state = HC_REDUCED;
+                PUSH(stack, ((hc_frame){reduct, HC_NONE, HC_ENTER}));
+                break;
+            }
+            result = hc_make(HC_APP, frame->function, result);
+            hc.nodes.items[result].normal = result;
+            hc.nodes.items[frame->node].normal = result;
+            stack.len--;
+            break;
+        } case HC_REDUCED:
+            hc.nodes.items[frame->node].normal = result;
+            stack.len--;
+            break;
+        }
+    }
+    return result;
+}
+
+// the node of packed term `p`, whose definitions have their nodes already
+uint32_t hc_from_packed(const table *functions, const packed *p) {
+    static _Thread_local STACK(uint32_t) ids = {0};
+    ids.len = 0;
+    for (uint32_t i = 0; i < p->len; i++) PUSH(ids, HC_NONE);
+    // the children of a node come after it
+    for (uint32_t i = p->len; i-- > 0;) {
+        uint32_t id;
+        switch (p->tags[i]) {
+        case PACKED_ABSTRACTION:
+            id = hc_make(HC_LAMBDA, ids.items[i+1], p->a[i]);
+            break;
+        case PACKED_APPLICATION:
+            id = hc_make(HC_APP, ids.items[i+1], ids.items[p->b[i]]);
+            break;
+        case PACKED_BOUND:
+            id = hc_make(HC_BOUND, p->a[i], 0);
+            break;
+        default:
+            if (p->b[i] == 0 && contains(functions, p->a[i])) {
+                id = hc.globals.items[p->a[i]];
+                assert(id < HC_BUSY);
+                // the body of an abstraction keeps the name
+                if (i > 0 && p->tags[i-1] == PACKED_ABSTRACTION) {
+                    id = hc_make(HC_NAMED, id, p->a[i]);
+                }
+            } else {
+                id = hc_make(HC_FREE, p->a[i], p->b[i]);
+            }
+            break;
+        }
+        ids.items[i] = id;
+    }
+    return ids.items[0];
+}
+
+// a definition whose node is being made, and the next node of its body to
+// look at for the definitions it uses
+typedef struct {
+    symbol name;
+    uint32_t next;
+} hc_pending;
+
+// Makes the nodes of the definitions `p` uses, directly or not, each after
+// the ones it uses itself. A definition that depends on itself is an error,
+// as in eval.
+void hc_globals(const table *functions, const packed *p) {
+    static _Thread_local STACK(hc_pending) pending = {0};
+    // the definitions left half made by an evaluation that gave up
+    while (pending.len > 0) hc.globals.items[POP(pending).name] = HC_NONE;
+    while (hc.globals.len < symbol_count()) PUSH(hc.globals, HC_NONE);
+
+    for (uint32_t i = 0; i < p->len; i++) {
+        if (p->tags[i] != PACKED_FREE || p->b[i] != 0) continue;
+        symbol name = p->a[i];
+        if (hc.globals.items[name] != HC_NONE || !contains(functions, name)) {
+            continue;
+        }
+        hc.globals.items[name] = HC_BUSY;
+        PUSH(pending, ((hc_pending){name, 0}));
+        while (pending.len > 0) {
+            hc_pending *top = &TOP(pending);
+            const packed *body = get(functions, top->name);
+            // the first definition it uses that has no node yet
+            symbol use = NO_SYMBOL;
+            while (top->next < body->len && use == NO_SYMBOL) {
+                uint32_t j = top->next++;
+                if (body->tags[j] != PACKED_FREE || body->b[j] != 0
+                    || !contains(functions, body->a[j])) {
+                    continue;
+                }
+                uint32_t id = hc.globals.items[body->a[j]];
+                if (id == HC_BUSY) {
+                    fprintf(error_out(),
+                            "ERROR: Recursion detected in function `%s`.\n",
+                            symbol_name(body->a[j]));
+                    give_up();
+                }
+                if (id == HC_NONE) use = body->a[j];
+            }
+            if (use != NO_SYMBOL) {
+                hc.globals.items[use] = HC_BUSY;
+                PUSH(pending, ((hc_pending){use, 0}));
+                continue;
+            }
+            WORK(unfoldings);
+            hc.globals.items[top->name] = hc_from_packed(functions, body);
+            pending.len--;
+        }
+    }
+}
+
+// forgets the nodes of the definitions, which may have changed; the nodes
+// and their normal forms stay, as they do not depend on any name
+void hc_forget_globals(void) {
+    for (size_t i = 0; i < hc.globals.len; i++) {
+        hc.globals.items[i] = HC_NONE;
+    }
+}
+
+// empties the store, giving its memory back
+void hc_reset(void) {
+    free(hc.nodes.items);
+    free(hc.slots);
+    hc.nodes.items = NULL;
+    hc.nodes.len = hc.nodes.cap = 0;
+    hc.slots = NULL;
+    hc.slot_cap = 0;
+    hc_forget_globals();
+}
+
+// a node to write out, and the application it is the argument of
+typedef struct {
+    uint32_t node;
+    uint32_t app;
+} hc_out_item;
 
-typedef const char* variable;
+// packs the tree `tm` unfolds to, giving each binder a fresh generation
+packed *hc_pack(uint32_t tm) {
+    static _Thread_local STACK(hc_out_item) todo = {0};
+    static _Thread_local STACK(uint32_t) a = {0};
+    static _Thread_local STACK(uint32_t) b = {0};
+    static _Thread_local STACK(uint8_t) tags = {0};
+    a.len = b.len = tags.len = 0;
+    todo.len = 0;
+    PUSH(todo, ((hc_out_item){tm, NO_NODE}));
+    while (todo.len > 0) {
+        hc_out_item item = POP(todo);
+        if (tags.len == PACKED_MAX_NODES) {
+            fprintf(error_out(), "ERROR: the normal form is too big to read"
+                    " back\n");
+            give_up();
+        }
+        if (item.app != NO_NODE) b.items[item.app] = tags.len;
+        hc_node n = hc.nodes.items[item.node];
+        switch (n.tag) {
+        case HC_LAMBDA: {
+            variable arg = fresh(n.b);
+            PUSH(tags, PACKED_ABSTRACTION);
+            PUSH(a, arg.name);
+            PUSH(b, arg.gen);
+            PUSH(todo, ((hc_out_item){n.a, NO_NODE}));
+            break;
+        } case HC_APP:
+            PUSH(todo, ((hc_out_item){n.b, tags.len}));
+            PUSH(tags, PACKED_APPLICATION);
+            PUSH(a, 0);
+            PUSH(b, 0);
+            PUSH(todo, ((hc_out_item){n.a, NO_NODE}));
+            break;
+        case HC_BOUND:
+            PUSH(tags, PACKED_BOUND);
+            PUSH(a, n.a);
+            PUSH(b, 0);
+            break;
+        case HC_FREE:
+            PUSH(tags, PACKED_FREE);
+            PUSH(a, n.a);
+            PUSH(b, n.b);
+            break;
+        case HC_NAMED:
+            PUSH(tags, PACKED_FREE);
+            PUSH(a, n.b);
+            PUSH(b, 0);
+            break;
+        }
+    }
+    return new_packed(tags.len, a.items, b.items, tags.items, NULL, NO_NODE);
+}
 
-typedef enum {
-    TYPE_ABSTRACTION,
-    TYPE_APPLICATION,
-    TYPE_VARIABLE,
-} term_type;
+// normalizes `tm` on the hash-consed graph
+term *eval_hashcons(const table *functions, const term *tm) {
+    if (hc.nodes.len > HC_KEEP_NODES) hc_reset();
+    packed *p = pack(tm, NO_NODE);
+    hc_globals(functions, p);
+    uint32_t root = hc_from_packed(functions, p);
+    free(p);
+    uint32_t normal = hc_normalize(root);
+    double start = timer_start();
+    p = hc_pack(normal);
+    term *result = unpack(p, false);
+    free(p);
+    timer_stop(start, &stats.readback_time);
+    return result;
+}
 
-typedef union {
-    abstraction abstraction;
-    application application;
-    variable    var;
-} term_val;
+typedef enum {
+    STRATEGY_STRICT,    // reduce arguments first and copy them
+    STRATEGY_NEED,      // call-by-need, share arguments
+    STRATEGY_MACHINE,   // call-by-need on the environment machine
+    STRATEGY_BYTECODE,  // the same machine running compiled bytecode
+    STRATEGY_NET,       // optimal reduction on an interaction net
+    STRATEGY_HASHCONS,  // strict, on a graph that shares equal subterms
+} strategy;
 
-typedef struct term {
-    term_type type;
-    term_val value;
-} term;
+strategy eval_strategy = STRATEGY_STRICT;
 
-void dump_(const term *term) {
-    if (term == NULL) {
-        printf("NULL");
-        return;
+// Reduces the term of `line` to normal form with the chosen strategy, or to
+// the form --form asks for. Call-by-need without natives only reduces the
+// root to weak head normal form and leaves the rest to print_result, which
+// forces what it prints; the result keeps its thunks.
+void reduce_line(const table *functions, line_t *line) {
+    term *tm = line->term;
+    line->lazy = false;
+    switch (eval_strategy) {
+    case STRATEGY_STRICT:
+        if (worker_count > 1) start_workers();
+        eval(functions, line->name, tm);
+        // a head normal form: the bodies of the leading binders too
+        while (eval_form == FORM_HEAD && tm->type == TYPE_ABSTRACTION) {
+            tm = tm->value.abstraction.term;
+            eval(functions, line->name, tm);
+        }
+        if (worker_count > 1) stop_workers();
+        break;
+    case STRATEGY_NEED: {
+        if (!native_enabled) {
+            whnf(functions, tm, false);
+            tm = deref(tm);
+            while (eval_form == FORM_HEAD && tm->type == TYPE_ABSTRACTION) {
+                tm = tm->value.abstraction.term;
+                whnf(functions, tm, true);
+                tm = deref(tm);
+            }
+            line->lazy = eval_form == FORM_NORMAL;
+            break;
+        }
+        normalize(functions, tm, false);
+        double start = timer_start();
+        line->term = expand(tm);
+        release(tm);
+        timer_stop(start, &stats.readback_time);
+        break;
     }
-    switch (term->type) {
-    case TYPE_ABSTRACTION: {
-        char *str = malloc(strlen(term->value.abstraction.arg)+1);
-        strcpy(str, term->value.var);
-        if (strchr(str, '-')) {
-            while (*str++ != '-');
-        }
-#ifdef DEBUG
-        printf("\\%s.", term->value.abstraction.arg);
-#else
-        printf("\\%s.", str);
-#endif //DEBUG
-        dump_(term->value.abstraction.term);
+    case STRATEGY_MACHINE:
+        line->term = eval_machine(functions, tm);
+        release(tm);
         break;
-  } case TYPE_APPLICATION:
-        printf("(");
-        dump_(term->value.application.left);
-        printf(")(");
-        dump_(term->value.application.right);
-        printf(")");
+    case STRATEGY_BYTECODE:
+        line->term = eval_bytecode(functions, tm);
+        release(tm);
         break;
-    case TYPE_VARIABLE: {
-        char *str = malloc(strlen(term->value.var)+1);
-        strcpy(str, term->value.var);
-        if (strchr(str, '-')) {
-            while (*str++ != '-');
-        }
-#ifdef DEBUG
-        printf("%s", term->value.var);
-#else
-        printf("%s", str);
-#endif //DEBUG
+    case STRATEGY_NET:
+        line->term = eval_net(functions, tm);
+        release(tm);
         break;
-    }}
+    case STRATEGY_HASHCONS:
+        line->term = eval_hashcons(functions, tm);
+        release(tm);
+        break;
+    }
+}
+
+// whether the result is a native that main prints as it is
+bool native_printable(const line_t *line) {
+    const term *tm = line->term;
+    if (tm->type != TYPE_NATIVE) return false;
+    native nat = tm->value.native;
+    switch (line->type) {
+    case TYPE_INT:
+        return nat.kind == NATIVE_NUMBER;
+    case TYPE_BOOL:
+        return nat.kind == NATIVE_TRUE
+            || (nat.kind == NATIVE_NUMBER && nat.number == 0);
+    default:
+        return false;
+    }
 }
 
-void dump(const term *term) {
-    dump_(term);
-    printf("\n");
+// gives every binder of the term of `line` a fresh generation
+void freshen_line(line_t *line) {
+    term *fresh = clone(line->term);
+    release(line->term);
+    line->term = fresh;
 }
 
-#define skip_spaces(str, pos)                                           \
-    while (*pos < strlen(str) && (str[*pos] == ' ' || str[*pos] == '\t')) { \
-        (*pos)++;                                                        \
+void eval_line(const table *functions, line_t *line) {
+    // a number or a boolean is only read off a normal form
+    if (eval_form != FORM_NORMAL && output_format == OUTPUT_TEXT
+        && line->type != NONE) {
+        fprintf(error_out(), "ERROR: `--form` other than `nf` cannot print"
+                " a `%s` result\n", line->type == TYPE_BOOL ? "bool" : "num");
+        give_up();
     }
+    start_budget();
+    // freshen the source binders so they cannot capture free names
+    freshen_line(line);
 
-char *parse_var(const char *str, size_t *pos) {
-    size_t i = 0;
-    while (*pos < strlen(str)
-           && str[*pos] != ' '  && str[*pos] != '.'
-           && str[*pos] != '\t' && str[*pos] != '\\'
-           && str[*pos] != '('  && str[*pos] != ')'
-           && str[*pos] != '=') {
-        *pos = *pos + 1;
-        i++;
+    reduce_line(functions, line);
+    // binary lambda calculus has no numbers, so it always takes the term
+    if (native_enabled
+        && (output_format != OUTPUT_TEXT || !native_printable(line))
+        && unnative(functions, line->term)) {
+        // finish what the natives left over on the lambda terms; an expanded
+        // result repeats the binders of shared parts, so freshen it again
+        freshen_line(line);
+        native_enabled = false;
+        reduce_line(functions, line);
+        native_enabled = true;
     }
+}
 
-    char *string = malloc(i * sizeof(char) + 1);
-    memcpy(string, str+*pos-i, i);
-    string[i] = '\0';
-    return string;
+// the node `tm` stands for once it is in weak head normal form, forcing it
+// first if the result of `line` is lazy
+const term *layer(const table *functions, const line_t *line, term *tm,
+                  bool open) {
+    if (line->lazy) whnf(functions, tm, open);
+    return deref(tm);
 }
 
-typedef struct {
-    bool error;
-    const char *msg;
-    term *term;
-} term_result;
+// the Church numeral the result of `line` is, or -1 if it is none
+long long decode_number(const table *functions, const line_t *line) {
+    const term *t = layer(functions, line, line->term, false);
+    if (t->type != TYPE_ABSTRACTION) return -1;
+    variable arg1 = t->value.abstraction.arg;
+    t = layer(functions, line, t->value.abstraction.term, true);
+    if (t->type != TYPE_ABSTRACTION) return -1;
+    variable arg2 = t->value.abstraction.arg;
+    t = layer(functions, line, t->value.abstraction.term, true);
+    for (long long i = 0;; i++) {
+        if (t->type == TYPE_VARIABLE) {
+            return var_eq(t->value.var, arg2) ? i : -1;
+        }
+        if (t->type != TYPE_APPLICATION) return -1;
+        const term *left = layer(functions, line,
+                                 t->value.application.left, true);
+        if (left->type != TYPE_VARIABLE || !var_eq(left->value.var, arg1)) {
+            return -1;
+        }
+        t = layer(functions, line, t->value.application.right, true);
+    }
+}
 
-#define check(exp, x)                                                   \
-    do {                                                                \
-        term_result _x = x;                                             \
-        if (_x.error) {                                                 \
-            return _x;                                                  \
-        } else {                                                        \
-            exp = _x.term;                                              \
-        }                                                               \
-    } while (0);
-
-#define VA_ARGS(...) , ##__VA_ARGS__
-#define ERR(str, ...)                                               \
-    do {                                                            \
-        term_result res;                                            \
-        size_t sz = snprintf(NULL, 0, str VA_ARGS(__VA_ARGS__));   \
-        char *buf = malloc(sz+1);                                   \
-        snprintf(buf, sz+1, str VA_ARGS(__VA_ARGS__));             \
-        res.error = true;                                           \
-        res.msg = buf;                                              \
-        return res;                                                 \
-    } while(0);                                                     \
-
-#define OK(val)                                 \
-    do {                                        \
-        term_result _res;                       \
-        _res.error = false;                     \
-        _res.term = val;                        \
-        return _res;                            \
-    } while(0);                                 \
-
-term_result parse(const char *str, size_t *pos) {
-    term *current = NULL;
-    term *next = NULL;
-    bool init = false;
-    if (sizeof(str) == 0) ERR("unexpected end of file\n");
+// the Church boolean the result of `line` is: 1 for true, 0 for false, -1
+// for neither
+int decode_bool(const table *functions, const line_t *line) {
+    const term *t = layer(functions, line, line->term, false);
+    if (t->type != TYPE_ABSTRACTION) return -1;
+    variable arg1 = t->value.abstraction.arg;
+    t = layer(functions, line, t->value.abstraction.term, true);
+    if (t->type != TYPE_ABSTRACTION) return -1;
+    variable arg2 = t->value.abstraction.arg;
+    t = layer(functions, line, t->value.abstraction.term, true);
+    if (t->type != TYPE_VARIABLE) return -1;
+    if (var_eq(t->value.var, arg1)) return 1;
+    return var_eq(t->value.var, arg2) ? 0 : -1;
+}
 
-    for (;;) {
-        skip_spaces(str, pos);
-        switch (str[*pos]) {
-        case '.':
-            ERR("unexpected token '.' at position %ld\n", *pos)
-                break;
-        case '\\':
-            (*pos)++;
-            init = true;
-            if (next == NULL) next = malloc(sizeof(term));
-            next->type = TYPE_ABSTRACTION;
-            skip_spaces(str, pos);
-            next->value.abstraction.arg = parse_var(str, pos);
-            // expect '.'
-            if (str[*pos] != '.') {
-                free(next);
-                ERR("invalid character '%c', '.' expected at position %ld\n",
-                    str[*pos], *pos);
-            }
-            (*pos)++;
-            check(next->value.abstraction.term, parse(str, pos));
-            current = next;
-            break;
-        case '(':
-            (*pos)++;
-            skip_spaces(str, pos);
-            term *nxt;
-            check(nxt, parse(str, pos));
-            skip_spaces(str, pos);
-            if (next == NULL) next = malloc(sizeof(term));
-            switch (str[*pos]) {
-            case ')':
-            case '\0':
-                (*pos)++;
-                init = true;
-                next = nxt;
-                if (current == NULL) {
-                    current = next;
-                } else {
-                    term *left = current;
-                    term *right = next;
-
-                    current = malloc(sizeof(term));
-                    current->type = TYPE_APPLICATION;
-                    current->value.application.left = left;
-                    current->value.application.right = right;
-                    next = current;
-                }
-                break;
-            default:
-                skip_spaces(str, pos);
-                init = true;
-                next->type = TYPE_APPLICATION;
-                next->value.application.left = nxt;
-                check(next->value.application.right, parse(str, pos));
-                current = next;
-                break;
-            }
-            break;
-        case ')':
-            OK(current)
-            break;
-        default: {
-            // expect variable
-            variable var = parse_var(str, pos);
+// Prints the result of `line`, decoded as a number or a boolean if its type
+// asks for it and it has that shape; --output=blc and blc8 write the term.
+// A lazy result is forced as far as it is printed, before printing starts.
+void print_result(FILE *out, const table *functions, line_t *line) {
+    if (output_format == OUTPUT_TEXT && native_printable(line)) {
+        native nat = line->term->value.native;
+        if (line->type == TYPE_BOOL) {
+            fprintf(out, nat.kind == NATIVE_TRUE ? "true\n" : "false\n");
+        } else {
+            fprintf(out, "%llu\n", (unsigned long long)nat.number);
+        }
+        return;
+    }
+    if (output_format == OUTPUT_TEXT && line->type == TYPE_INT) {
+        long long n = decode_number(functions, line);
+        if (n >= 0) {
+            fprintf(out, "%lld\n", n);
+            return;
+        }
+    }
+    if (output_format == OUTPUT_TEXT && line->type == TYPE_BOOL) {
+        int b = decode_bool(functions, line);
+        if (b >= 0) {
+            fprintf(out, b ? "true\n" : "false\n");
+            return;
+        }
+    }
+    if (line->lazy) {
+        reduce_need(functions, line->term, false, NEED_NORMALIZE,
+                    output_format == OUTPUT_TEXT ? print_depth : 0);
+    }
+    if (output_format != OUTPUT_TEXT) {
+        dump_blc(out, line->term);
+    } else {
+        dump(out, line->term);
+    }
+}
 
-            skip_spaces(str, pos);
-            if (next == NULL) next = malloc(sizeof(term));
-            init = true;
-            next->type = TYPE_VARIABLE;
-            next->value.var = var;
-            skip_spaces(str, pos);
-            init = true;
-            if (current == NULL) {
-                current = next;
-            } else {
-                term *left = current;
-                term *right = next;
+// Parses a query: a term, optionally preceded by `num =`, `int =` or `bool =`
+// to print the result as a number or a boolean.
+void parse_query(const char *src, size_t len, line_t *query) {
+    lexer lx;
+    lexer_init(&lx, src, len);
+    query->type = NONE;
+    token type = peek(&lx, 0);
+    if (type.kind == TOKEN_NAME && peek(&lx, 1).kind == TOKEN_EQUALS) {
+        if (token_is(type, "bool")) {
+            query->type = TYPE_BOOL;
+        } else if (token_is(type, "int") || token_is(type, "num")) {
+            query->type = TYPE_INT;
+        } else {
+            parse_error(type, "expected `bool`, `int` or `num`");
+        }
+        advance(&lx);
+        advance(&lx);
+    }
+    query->term = parse(&lx);
+    token end = peek(&lx, 0);
+    if (end.kind != TOKEN_END) parse_error(end, "expected the end of the query");
+}
 
-                current = malloc(sizeof(term));
-                current->type = TYPE_APPLICATION;
-                current->value.application.left = left;
-                current->value.application.right = right;
-                next = current;
-            }
-            break;
-        }}
-        skip_spaces(str, pos);
-        if (*pos >= strlen(str)) OK(next);
-        next = NULL;
+// Forgets the frames a query abandoned halfway left on the work stacks. Its
+// terms, thunks and machine cells go with the pool of the query.
+void abandon_query(void) {
+    release_todo.len = 0;
+    parse_stack.len = 0;
+    eval_stack.len = 0;
+    need_stack.len = 0;
+    machine_stack.len = 0;
+    hc_todo.len = 0;
+    hc_built.len = 0;
+    hc_reset();
+}
+
+// Answers one query against the definitions on `out`. A query that fails
+// prints its error there instead, and everything it made is freed.
+void answer(const table *functions, const char *src, size_t len, FILE *out) {
+    line_t query = {NO_SYMBOL, NULL, NULL, NONE, NULL, NULL, NULL,
+                    {NATIVE_UNKNOWN, NO_SYMBOL, 0}, false};
+    jmp_buf failed;
+    query_out = out;
+    query_abort = &failed;
+    term_pool outer = pool_enter();
+    if (setjmp(failed) == 0) {
+        parse_query(src, len, &query);
+        eval_line(functions, &query);
+        print_result(out, functions, &query);
+        release_line(&query);
+    } else {
+        abandon_query();
     }
+    pool_leave(outer);
+    query_out = NULL;
+    query_abort = NULL;
+}
 
-    if (!init) {
-        free(current);
-        ERR("Not implemented");
-    };
+// whether a line of input holds no query
+bool blank_line(const char *src, size_t len) {
+    return strspn(src, " \t\r\n") == len;
+}
 
-    OK(next);
+// Answers queries against the definitions, one per line of `in`, until the
+// end of the input. A query that fails prints its error to `out` and the
+// next one runs as usual.
+void serve(const table *functions, FILE *in, FILE *out) {
+    char *src = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&src, &cap, in)) >= 0) {
+        if (blank_line(src, len)) continue;
+        answer(functions, src, len, out);
+        fflush(out);
+    }
+    free(src);
 }
 
-typedef enum {
-    NONE = 0,
-    TYPE_INT,
-    TYPE_BOOL,
-} display_type;
+// With --threads, the queries on standard input are answered by that many
+// threads at once. Each thread reads the next query and answers it into a
+// buffer of its own; answers are written as soon as the ones before them
+// are, so they come out in the order of the queries. At most SERVE_WINDOW
+// queries are read ahead of the last answer written.
+
+#define SERVE_WINDOW 256
 
 typedef struct {
-    const char *name;
-    term *term;
-    display_type type;
-} line_t;
+    char *answer;
+    size_t len;
+    bool done;
+} serve_job;
 
-line_t *parse_line(const char *line) {
-    if (strlen(line) == 0) return NULL;
-    // comments
-    if (line[0] == '-' && line[1] == '-') return NULL;
-    size_t pos = 0;
-    skip_spaces(line, &pos);
-    const char *name = parse_var(line, &pos);
-    skip_spaces(line, &pos);
+typedef struct {
+    const table *functions;
+    FILE *in;
+    FILE *out;
+    bool native;            // native_enabled is per thread
+    serve_job jobs[SERVE_WINDOW];
+    size_t read;            // queries read so far
+    size_t written;         // answers written so far
+    bool end;               // the input is finished
+    pthread_mutex_t reading;    // taken first, by the thread reading
+    pthread_mutex_t lock;       // the fields above
+    pthread_cond_t room;        // an answer was written
+} serve_queue;
 
-    display_type tp = NONE;
+void *serve_jobs(void *arg) {
+    serve_queue *q = arg;
+    native_enabled = q->native;
+    char *src = NULL;
+    size_t cap = 0;
+    for (;;) {
+        pthread_mutex_lock(&q->reading);
+        pthread_mutex_lock(&q->lock);
+        while (!q->end && q->read - q->written == SERVE_WINDOW) {
+            pthread_cond_wait(&q->room, &q->lock);
+        }
+        bool end = q->end;
+        pthread_mutex_unlock(&q->lock);
+        ssize_t len = 0;
+        while (!end && (len = getline(&src, &cap, q->in)) >= 0
+               && blank_line(src, len)) {}
+        pthread_mutex_lock(&q->lock);
+        if (end || len < 0) {
+            q->end = true;
+            pthread_cond_broadcast(&q->room);
+            pthread_mutex_unlock(&q->lock);
+            pthread_mutex_unlock(&q->reading);
+            break;
+        }
+        serve_job *job = &q->jobs[q->read++ % SERVE_WINDOW];
+        job->done = false;
+        pthread_mutex_unlock(&q->lock);
+        pthread_mutex_unlock(&q->reading);
 
-    // expect `=`
-    if (line[pos++] != '=') {
-        // allow type specification
-        if (strcmp(name, "main") == 0) {
-            pos--;
-            const char *type = parse_var(line, &pos);
-            if (strcmp(type, "bool") == 0) {
-                tp = TYPE_BOOL;
-            } else if (strcmp(type, "int") == 0 || strcmp(type, "num") == 0) {
-                tp = TYPE_INT;
-            }
-            skip_spaces(line, &pos);
-        }
-        if (line[pos++] != '=') {
-            printf("Parse error: expected `=`, found `%c`\n", line[pos-1]);
+        FILE *out = open_memstream(&job->answer, &job->len);
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: out of memory\n");
             exit(1);
         }
+        answer(q->functions, src, len, out);
+        fclose(out);
+
+        pthread_mutex_lock(&q->lock);
+        job->done = true;
+        while (q->written < q->read
+               && q->jobs[q->written % SERVE_WINDOW].done) {
+            serve_job *next = &q->jobs[q->written++ % SERVE_WINDOW];
+            fwrite(next->answer, 1, next->len, q->out);
+            free(next->answer);
+            next->done = false;
+        }
+        fflush(q->out);
+        pthread_cond_broadcast(&q->room);
+        pthread_mutex_unlock(&q->lock);
     }
-    skip_spaces(line, &pos);
-    term_result res = parse(line, &pos);
-    if (res.error) {
-        printf("Parse error: %s\n", res.msg);
-        return NULL;
-    } else {
-        line_t *ln = malloc(sizeof(line_t));
-        ln->name = name;
-        ln->term = res.term;
-        ln->type = tp;
-        return ln;
+    free(src);
+    return NULL;
+}
+
+// answers the queries on `in` with `threads` threads, in order
+void serve_parallel(const table *functions, FILE *in, FILE *out,
+                    size_t threads) {
+    serve_queue *q = allocate(sizeof(serve_queue));
+    memset(q, 0, sizeof(serve_queue));
+    q->functions = functions;
+    q->in = in;
+    q->out = out;
+    q->native = native_enabled;
+    pthread_mutex_init(&q->reading, NULL);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->room, NULL);
+    pthread_t *others = allocate(threads * sizeof(pthread_t));
+    for (size_t i = 1; i < threads; i++) {
+        if (pthread_create(&others[i], NULL, serve_jobs, q) != 0) {
+            fprintf(stderr, "ERROR: could not start a thread\n");
+            exit(1);
+        }
     }
+    serve_jobs(q);
+    for (size_t i = 1; i < threads; i++) pthread_join(others[i], NULL);
+    free(others);
+    pthread_cond_destroy(&q->room);
+    pthread_mutex_destroy(&q->lock);
+    pthread_mutex_destroy(&q->reading);
+    free(q);
 }
 
-typedef struct list {
-    struct list *next;
-    line_t line;
-} list;
+typedef struct {
+    const table *functions;
+    int listener;
+    bool native;        // native_enabled is per thread
+} server;
 
-void set(list **list, line_t *line) {
-    if (*list == NULL) {
-        *list = malloc(sizeof(struct list));
-        (*list)->line = *line;
-        (*list)->next = NULL;
-        return;
+// accepts connections one at a time and answers the queries on each
+void *serve_connections(void *arg) {
+    server *srv = arg;
+    native_enabled = srv->native;
+    for (;;) {
+        int fd = accept(srv->listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "ERROR: accept failed: %s (ERRNO %d)\n",
+                    strerror(errno), errno);
+            exit(1);
+        }
+        FILE *in = fdopen(fd, "r");
+        FILE *out = in == NULL ? NULL : fdopen(dup(fd), "w");
+        if (in == NULL || out == NULL) {
+            fprintf(stderr, "ERROR: could not open connection: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+        serve(srv->functions, in, out);
+        fclose(out);
+        fclose(in);
     }
-    if ((*list)->line.name == NULL) {
-        (*list)->line = *line;
-        (*list)->next = NULL;
-        return;
+    return NULL;
+}
+
+// Listens on a unix socket at `path` and answers on `threads` connections
+// at once. Does not return.
+void serve_socket(const table *functions, const char *path, size_t threads) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR: socket path `%s` is too long\n", path);
+        exit(1);
     }
+    strcpy(addr.sun_path, path);
 
-    struct list *last = *list;
-    struct list *current = last->next;
-    for (;current != NULL; last = current, current = current->next) {
-        if (current->line.name == NULL ||
-            strcmp(current->line.name,line->name) == 0) {
-            last->next = current;
-            current->line = *line;
-            current->next = NULL;
-            return;
+    // a socket left behind by an earlier server is replaced, other files not
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0
+        || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(listener, 64) != 0) {
+        fprintf(stderr, "ERROR: could not listen on `%s`: %s (ERRNO %d)\n",
+                path, strerror(errno), errno);
+        exit(1);
+    }
+    // a client that hangs up early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    server srv = {functions, listener, native_enabled};
+    for (size_t i = 1; i < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connections, &srv) != 0) {
+            fprintf(stderr, "ERROR: could not start a thread\n");
+            exit(1);
         }
+        pthread_detach(thread);
     }
-    last->next = malloc(sizeof(struct list));
-    last->next->line = *line;
-    last->next->next = NULL;
+    serve_connections(&srv);
 }
 
-bool contains(const list *list, const char *name) {
-    for (;list != NULL; list = list->next) {
-        if (list->line.name == NULL) return NULL;
-        if (strcmp(list->line.name, name) == 0) {
-            return true;
+// Maps a file into memory, to be parsed in place without reading it into a
+// copy. An empty file is "", with nothing to unmap.
+const char *map_file(const char *file_name, size_t *size) {
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(error_out(), "ERROR: could not open file: %s (ERRNO %d)\n",
+                strerror(errno), errno);
+        if (fd >= 0) close(fd);
+        give_up();
+    }
+    *size = st.st_size;
+    const char *src = "";
+    if (*size > 0) {
+        src = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (src == MAP_FAILED) {
+            fprintf(error_out(), "ERROR: could not map file: %s (ERRNO %d)\n",
+                    strerror(errno), errno);
+            close(fd);
+            give_up();
         }
     }
-    return false;
+    close(fd);
+    return src;
 }
 
-term *get(const list *list, const char *name) {
-    for (;list != NULL; list = list->next) {
-        if (list->line.name == NULL) return NULL;
-        if (strcmp(list->line.name, name) == 0) {
-            return list->line.term;
+// With --watch, the entry point is evaluated again whenever the file is
+// saved. reindex finds the definitions in the new text, lexing only around
+// what changed, and drop_changed forgets the ones that were added, removed or
+// edited, and what uses them; the others keep their parsed terms and the
+// normal forms the strict strategy kept. The entry point is only evaluated
+// when it was dropped or its last evaluation failed. Errors are reported and
+// the watch goes on.
+
+#define WATCH_SETTLE_MS 20  // writes closer together count as one save
+
+// a copy of the file, in a buffer that is reused
+typedef struct {
+    char *text;
+    size_t len;
+    size_t cap;
+} source_text;
+
+typedef struct {
+    const char *file_name;
+    source_text text;       // what the definitions in the table came from
+    source_text next;       // the text being indexed
+    source_list defs;       // of `text`
+    source_list next_defs;
+    source_index index;     // of `defs`
+    source_index next_index;
+    bool stale;             // the entry point needs evaluating
+    bool partial;           // a parse error left definitions out
+} watcher;
+
+// Reads the whole file into `out`. Reading into the same buffer each time is
+// cheaper than mapping the file again.
+void read_file(const char *file_name, source_text *out) {
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(error_out(), "ERROR: could not open file: %s (ERRNO %d)\n",
+                strerror(errno), errno);
+        if (fd >= 0) close(fd);
+        give_up();
+    }
+    if (out->cap < (size_t)st.st_size + 1) {
+        out->cap = st.st_size + 1;
+        out->text = reallocate(out->text, out->cap);
+    }
+    out->len = 0;
+    for (;;) {
+        ssize_t n = read(fd, out->text + out->len, out->cap - out->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            fprintf(error_out(), "ERROR: could not read file: %s (ERRNO %d)\n",
+                    strerror(errno), errno);
+            close(fd);
+            give_up();
+        }
+        if (n == 0) break;
+        out->len += n;
+        if (out->len == out->cap) {
+            // it grew since fstat
+            out->cap *= 2;
+            out->text = reallocate(out->text, out->cap);
         }
     }
-    return NULL;
+    close(fd);
 }
 
-void delete(list **list, const char *name) {
-    if (*list == NULL) {
-        return;
+void reserve_definitions(source_list *defs, size_t len) {
+    if (defs->cap >= len) return;
+    defs->cap = len;
+    defs->items = reallocate(defs->items, len * sizeof(source_definition));
+}
+
+// Finds the definitions `after` in the text `src`, given the definitions
+// `before` of the text `old`. Only the part that differs is lexed: from the
+// definition before the first changed byte, to the first definition that
+// starts where an old one did in the unchanged tail. The definitions from
+// there on are the old ones, moved.
+void reindex(const source_text *old, const source_list *before,
+             const source_text *src, source_list *after) {
+    // compare a block at a time, then find the byte within the block
+    const size_t block = 4096;
+    size_t common = old->len < src->len ? old->len : src->len;
+    size_t prefix = 0;
+    while (prefix + block <= common
+           && memcmp(old->text + prefix, src->text + prefix, block) == 0) {
+        prefix += block;
+    }
+    while (prefix < common && old->text[prefix] == src->text[prefix]) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix + block <= common - prefix
+           && memcmp(old->text + old->len - suffix - block,
+                     src->text + src->len - suffix - block, block) == 0) {
+        suffix += block;
+    }
+    while (suffix < common - prefix
+           && old->text[old->len - 1 - suffix]
+              == src->text[src->len - 1 - suffix]) {
+        suffix++;
     }
 
-    if ((*list)->next == NULL) {
-        (*list) = NULL;
-        return;
+    // a definition is kept when the one after it, whose header ends it,
+    // is also before the change
+    size_t keep = 0;
+    while (keep + 2 < before->len && before->items[keep+2].at.pos <= prefix) {
+        keep++;
+    }
+    reserve_definitions(after, keep);
+    memcpy(after->items, before->items, keep * sizeof(source_definition));
+    after->len = keep;
+    lexer lx;
+    lexer_init(&lx, src->text, src->len);
+    if (keep > 0) {
+        source_offset at = before->items[keep].at;
+        lx.pos = at.pos;
+        lx.line = at.line;
+        lx.line_start = at.line_start;
     }
 
-    struct list *last = *list;
-    struct list *current = last->next;
-    for (;current != NULL; current = current->next) {
-        if (strcmp(current->line.name, name) == 0) {
-            last->next = current->next;
-            return;
+    size_t tail = src->len - suffix;    // where the unchanged tail starts
+    size_t j = keep;                    // the old definition to line up with
+    for (;;) {
+        token first = peek(&lx, 0);
+        size_t pos = first.text - src->text;
+        if (first.kind != TOKEN_END && pos >= tail) {
+            // the same position in the old text
+            size_t old_pos = pos - src->len + old->len;
+            while (j < before->len && before->items[j].at.pos < old_pos) j++;
+            if (j < before->len && before->items[j].at.pos == old_pos) {
+                size_t line = before->items[j].at.line;
+                ptrdiff_t lines = (ptrdiff_t)first.line - (ptrdiff_t)line;
+                reserve_definitions(after, after->len + before->len - j);
+                for (; j < before->len; j++) {
+                    source_definition def = before->items[j];
+                    bool same_line = def.at.line == line;
+                    def.at.pos = def.at.pos - old->len + src->len;
+                    def.at.line += lines;
+                    def.at.line_start = same_line
+                        ? pos - (first.column - 1)
+                        : def.at.line_start - old->len + src->len;
+                    after->items[after->len++] = def;
+                }
+                return;
+            }
         }
+        if (!index_next(&lx, after)) return;
     }
 }
 
-void dump_list(const list *list) {
-    for (;list != NULL; list = list->next) {
-        printf("%p: {next: %p, line: "
-               "{name: '%s', term: ",
-               (void*)list, (void*)list->next, list->line.name);
-        dump_(list->line.term);
-        printf("}}\n");
-    }
-}
+void watch_update(watcher *w, table *functions, symbol entry) {
+    read_file(w->file_name, &w->next);
+    reindex(&w->text, &w->defs, &w->next, &w->next_defs);
 
+    index_by_name(&w->next_defs, &w->next_index);
+    drop_changed(functions, &w->index, &w->next_index);
+    source_index index = w->index;
+    w->index = w->next_index;
+    w->next_index = index;
+    source_text text = w->text;
+    w->text = w->next;
+    w->next = text;
+    source_list defs = w->defs;
+    w->defs = w->next_defs;
+    w->next_defs = defs;
 
-term *clone(term *other) {
-    term *new = malloc(sizeof(term));
-    new->type = other->type;
-    switch (other->type) {
-    case TYPE_ABSTRACTION:
-        new->value.abstraction.arg = other->value.abstraction.arg;
-        new->value.abstraction.term = clone(other->value.abstraction.term);
-        break;
-    case TYPE_APPLICATION:
-        new->value.application.left = clone(other->value.application.left);
-        new->value.application.right = clone(other->value.application.right);
-        break;
-    case TYPE_VARIABLE:
-        new->value.var = other->value.var;
-        break;
+    if (!contains(functions, entry)) w->stale = true;
+    bool recheck = w->partial;
+    w->partial = true;
+    parse_reachable(functions, w->text.text, w->text.len, &w->index, entry,
+                    recheck);
+    w->partial = false;
+    if (!w->stale) return;
+
+    line_t *line = lookup(functions, entry);
+    if (line == NULL) {
+        fprintf(error_out(), "ERROR: `%s` does not define `%s`\n",
+                w->file_name, symbol_name(entry));
+        give_up();
     }
-    return new;
+    // evaluate a copy, so the definition keeps its source term
+    line_t result = {entry, NULL, unpack(line->body, false), line->type,
+                     NULL, NULL, NULL, {NATIVE_UNKNOWN, NO_SYMBOL, 0},
+                     false};
+    hc_forget_globals();
+    eval_line(functions, &result);
+    print_result(stdout, functions, &result);
+    release_line(&result);
+    w->stale = false;
 }
 
-void update(term *tm, line_t *line) {
-    switch (tm->type) {
-    case TYPE_ABSTRACTION:
-        update(tm->value.abstraction.term, line);
-        break;
-    case TYPE_APPLICATION:
-        update(tm->value.application.left, line);
-        update(tm->value.application.right, line);
-        break;
-    case TYPE_VARIABLE:
-        if (strcmp(tm->value.var, line->name) == 0) {
-            *tm = *clone(line->term);
+// blocks until `base` in the watched directory is written or replaced, and
+// then until the writes settle
+void wait_for_change(int fd, const char *base) {
+    _Alignas(struct inotify_event) char buf[4096];
+    int timeout = -1;
+    for (;;) {
+        struct pollfd ready = {fd, POLLIN, 0};
+        int n = poll(&ready, 1, timeout);
+        if (n == 0) return;
+        ssize_t len = n < 0 ? -1 : read(fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: could not watch the file: %s (ERRNO %d)\n",
+                    strerror(errno), errno);
+            exit(1);
+        }
+        for (ssize_t i = 0; i < len;) {
+            const struct inotify_event *event = (void*)(buf + i);
+            if (event->len > 0 && strcmp(event->name, base) == 0) {
+                timeout = WATCH_SETTLE_MS;
+            }
+            i += sizeof(struct inotify_event) + event->len;
         }
-        break;
     }
 }
 
-void prefix_args(term *tm, const char *prefix, list *vars, const list *functions) {
-    switch (tm->type) {
-    case TYPE_ABSTRACTION: {
-        char *new_str = malloc((strlen(tm->value.abstraction.arg)
-                                + 1 + strlen(prefix)+1)*sizeof(char));
-        memcpy(new_str, prefix, strlen(prefix));
-        new_str[strlen(prefix)] = '-';
-        memcpy(new_str+strlen(prefix) + 1,
-               tm->value.abstraction.arg, strlen(tm->value.abstraction.arg));
-        new_str[strlen(prefix)+strlen(tm->value.abstraction.arg)+1] = '\0';
+// Evaluates `entry` from the file, then again after each change to it. Does
+// not return.
+_Noreturn void watch(const char *file_name, symbol entry) {
+    // editors often save by replacing the file, so watch its directory
+    const char *slash = strrchr(file_name, '/');
+    const char *base = slash == NULL ? file_name : slash + 1;
+    size_t dir_len = slash == NULL ? 1 : slash == file_name ? 1
+        : (size_t)(slash - file_name);
+    char *dir = allocate(dir_len + 1);
+    memcpy(dir, slash == NULL ? "." : file_name, dir_len);
+    dir[dir_len] = '\0';
+    int fd = inotify_init1(IN_CLOEXEC);
+    uint32_t events = IN_CLOSE_WRITE | IN_MOVED_TO;
+    if (fd < 0 || inotify_add_watch(fd, dir, events) < 0) {
+        fprintf(stderr, "ERROR: could not watch %s: %s (ERRNO %d)\n",
+                dir, strerror(errno), errno);
+        exit(1);
+    }
+    free(dir);
 
-        line_t *ln = malloc(sizeof(line_t));
-        ln->name = tm->value.abstraction.arg;
-        set(&vars, ln);
-        prefix_args(tm->value.abstraction.term, prefix, vars, functions);
-        delete(&vars, ln->name);
-        free(ln);
+    table functions = {0};
+    watcher *w = allocate(sizeof(watcher));
+    *w = (watcher){file_name, {0}, {0}, {0}, {0}, {0}, {0}, true, false};
+    for (;;) {
+        jmp_buf failed;
+        query_out = stderr;
+        query_abort = &failed;
+        if (setjmp(failed) == 0) watch_update(w, &functions, entry);
+        query_out = NULL;
+        query_abort = NULL;
+        fflush(stdout);
+        wait_for_change(fd, base);
+    }
+}
 
-        tm->value.abstraction.arg = new_str;
-        break;
-    } case TYPE_APPLICATION:
-        prefix_args(tm->value.application.left,  prefix, vars, functions);
-        prefix_args(tm->value.application.right, prefix, vars, functions);
-        break;
-    case TYPE_VARIABLE: {
-        if (!contains(functions, tm->value.var) && strchr(tm->value.var, '-') == NULL) {
-            char *new_str = malloc((strlen(tm->value.var)
-                                    + 1 + strlen(prefix)+1)*sizeof(char));
-            memcpy(new_str, prefix, strlen(prefix));
-            new_str[strlen(prefix)] = '-';
-            memcpy(new_str+strlen(prefix)
-                   + 1, tm->value.var, strlen(tm->value.var));
-            new_str[strlen(prefix)+strlen(tm->value.var)+1] = '\0';
-            tm->value.var = new_str;
-        }
-        break;
-    }}
+const char *stats_json = NULL;    // file to write the report to as JSON
+
+// reports the counters at exit, to stderr and optionally as JSON
+void print_stats(void) {
+#define TEXT_COUNTER(name)                                              \
+    fprintf(stderr, "%-14s %llu\n", #name, (unsigned long long)stats.name);
+#define TEXT_TIME(name, field)                                          \
+    fprintf(stderr, "%-14s %.6f\n", #name "_s", stats.field);
+    STATS_COUNTERS(TEXT_COUNTER)
+    fprintf(stderr, "%-14s %td\n", "peak_nodes", pool.peak);
+    STATS_TIMES(TEXT_TIME)
+
+    if (stats_json == NULL) return;
+    FILE *file = fopen(stats_json, "w");
+    if (file == NULL) {
+        fprintf(stderr,
+                "ERROR: could not write stats to %s: %s (ERRNO %d)\n",
+                stats_json, strerror(errno), errno);
+        return;
+    }
+#define JSON_COUNTER(name)                                              \
+    fprintf(file, "  \"%s\": %llu,\n", #name, (unsigned long long)stats.name);
+#define JSON_TIME(name, field)                                          \
+    fprintf(file, ",\n  \"%s\": %.6f", #name "_s", stats.field);
+    fprintf(file, "{\n");
+    STATS_COUNTERS(JSON_COUNTER)
+    fprintf(file, "  \"peak_nodes\": %td", pool.peak);
+    STATS_TIMES(JSON_TIME)
+    fprintf(file, "\n}\n");
+    fclose(file);
+#undef TEXT_COUNTER
+#undef TEXT_TIME
+#undef JSON_COUNTER
+#undef JSON_TIME
 }
 
-bool eval(const list *functions, const char *current_function,
-          term *tm, int num) {
-    list *next_functions        = (list*)functions;
-    char *next_current_function = (char*)current_function;
-    term *next_tm = tm;
-    int next_num  = num;
+bool use_cache = false;
 
-    switch (tm->type) {
-    case TYPE_ABSTRACTION:
-        if (tm->value.abstraction.term->type == TYPE_VARIABLE) {
-            return true;
-        } else {
-            next_functions        = (list*)functions;
-            next_current_function = (char*)current_function;
-            next_tm               = tm->value.abstraction.term;
-            next_num              = num++;
-            break;
-        }
-    case TYPE_APPLICATION: {
-        term *left = tm->value.application.left;
-        eval(functions, current_function,
-             tm->value.application.right, num++);
-        
-        while (left->type != TYPE_ABSTRACTION) {
-            if (eval(functions, current_function, left, num++) && left->type != TYPE_ABSTRACTION) {
-                return true;
-            }
+void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options] <file name>\n"
+            "Options:\n"
+            "  --strategy=strict   reduce arguments before substituting them"
+            " (default)\n"
+            "  --strategy=need     call-by-need, share arguments between uses\n"
+            "  --strategy=machine  call-by-need on an environment machine\n"
+            "  --strategy=bytecode the environment machine on compiled bytecode\n"
+            "  --strategy=net      optimal reduction on an interaction net\n"
+            "  --strategy=hashcons strict, on a graph where equal subterms"
+            " are one node\n"
+            "                      reduced once\n"
+            "  --native            compute on numerals and booleans as integers"
+            " (strict\n"
+            "                      and need only)\n"
+            "  --threads=N         reduce big independent subterms on N"
+            " threads (strict\n"
+            "                      only)\n"
+            "  --max-steps=N       stop after N beta reductions\n"
+            "  --max-memory=SIZE   stop when the process holds SIZE bytes"
+            " (K, M or G)\n"
+            "  --timeout=SECONDS   stop after SECONDS of wall time\n"
+            "                      (a stopped evaluation exits with code 3)\n"
+            "  --entry=NAME        evaluate NAME instead of main; only what it"
+            " uses is\n"
+            "                      parsed\n"
+            "  --compile=FILE      write main as a standalone C program to"
+            " FILE\n"
+            "  --watch             evaluate again whenever the file changes,"
+            " reusing\n"
+            "                      what the change did not touch\n"
+            "  --cache             keep the parsed definitions in"
+            " <file name>.cache\n"
+            "                      and load them from there while the file"
+            " is unchanged\n"
+            "  --serve             read definitions from the file, then answer\n"
+            "                      queries from stdin, one per line\n"
+            "  --serve=SOCKET      answer them on connections to a unix socket,\n"
+            "                      with --threads=N connections at once\n"
+            "  --output=blc        print the result as binary lambda calculus,"
+            " one bit\n"
+            "                      per character\n"
+            "  --output=blc8       the same, eight bits to a byte\n"
+            "  --form=whnf         reduce only to weak head normal form (strict"
+            " and need\n"
+            "                      only)\n"
+            "  --form=hnf          reduce to head normal form, also under the"
+            " leading\n"
+            "                      binders\n"
+            "  --depth=N           print N layers of the result and `...` for"
+            " the rest\n"
+            "  --stats             print work counters to stderr at exit\n"
+            "  --stats-json=FILE   also write them to FILE as JSON\n"
+            "  --profile=FILE      write the beta reductions of each chain of"
+            " definitions\n"
+            "                      to FILE as folded stacks and print a table"
+            " of the\n"
+            "                      work of each definition (strict only)\n",
+            program);
+    exit(1);
+}
+
+// the value of `option`, with a K, M or G suffix if it is `sized`
+uint64_t parse_amount(const char *option, const char *arg, bool sized,
+                      const char *program) {
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (sized && *end != '\0' && end[1] == '\0') {
+        int shift = *end == 'K' ? 10 : *end == 'M' ? 20 : *end == 'G' ? 30 : 0;
+        if (shift != 0 && n <= UINT64_MAX >> shift) {
+            n <<= shift;
+            end++;
         }
-        
-        line_t line;
-        line.name = left->value.abstraction.arg;
-        line.term = tm->value.application.right;
-        
-        update(left->value.abstraction.term, &line);
-        
-        *tm = *left->value.abstraction.term;
-        break;
-    } case TYPE_VARIABLE: {
-          // detect recursion:
-
-          if (strcmp(tm->value.var, current_function) == 0) {
-              fprintf(stderr,
-                      "ERROR: Recursion detected in function `%s`.\n",
-                      current_function);
-              exit(1);
-          }
-          term *new_term = get(functions, tm->value.var);
-          if (new_term == NULL) {
-              return true;
-          } else {
-              term *eval_term = clone(new_term);
-              list *ls = malloc(sizeof(list));
-              
-              int len = snprintf(NULL, 0, "%d-%s", num, tm->value.var);
-                  if (len < 0) {
-                      fprintf(stderr,
-                              "sprintf(3) ERROR: %s (ERRNO %d)",
-                              strerror(errno), errno);
-                      exit(1);
-                  }
-                  char *prefix = malloc(len+1);
-                  snprintf(prefix, len+1, "%d-%s", num, tm->value.var);
-                  
-                  prefix_args(eval_term, prefix, ls, functions);
-                  free(ls);
-                  eval(functions, tm->value.var, eval_term, num++);
-                  new_term = malloc(sizeof(term));
-                  *new_term = *eval_term;
-              }
-          
-              *tm = *new_term;
-              return false;
-      }}
-    
-    return eval(next_functions, next_current_function,
-                next_tm, next_num);
-}
-
-void eval_line(const list *functions, const char *name) {
-    term *term = get(functions, name);
-    eval(functions, name, term, 0);
+    }
+    if (*end != '\0' || end == arg || n == 0 || arg[0] == '-') {
+        fprintf(stderr, "`%s` needs a positive number%s\n", option,
+                sized ? " of bytes" : "");
+        usage(program);
+    }
+    return n;
 }
 
 int main(int argc, char **argv) {
@@ -552,110 +7141,263 @@ int main(int argc, char **argv) {
         fprintf(stderr, "What did you do..., just open it normally...\n");
         exit(69);
     }
-    if (argc < 2) {
-        fprintf(stderr,
-                "Not enough arguments!\nUsage: %s <file name>\n", argv[0]);
-        exit(1);
-    }
 
-    FILE *file = fopen(argv[1], "r");
-    if (file == NULL) {
+    const char *file_name = NULL;
+    bool serving = false;
+    bool watching = false;
+    const char *socket_path = NULL;
+    const char *compile_path = NULL;
+    symbol entry_name = intern("main", strlen("main"));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--strategy=strict") == 0) {
+            eval_strategy = STRATEGY_STRICT;
+        } else if (strcmp(argv[i], "--strategy=need") == 0) {
+            eval_strategy = STRATEGY_NEED;
+        } else if (strcmp(argv[i], "--strategy=machine") == 0) {
+            eval_strategy = STRATEGY_MACHINE;
+        } else if (strcmp(argv[i], "--strategy=bytecode") == 0) {
+            eval_strategy = STRATEGY_BYTECODE;
+        } else if (strcmp(argv[i], "--strategy=net") == 0) {
+            eval_strategy = STRATEGY_NET;
+        } else if (strcmp(argv[i], "--strategy=hashcons") == 0) {
+            eval_strategy = STRATEGY_HASHCONS;
+        } else if (strcmp(argv[i], "--native") == 0) {
+            native_enabled = true;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            char *end;
+            long n = strtol(argv[i] + 10, &end, 10);
+            if (*end != '\0' || n < 1 || n > MAX_THREADS) {
+                fprintf(stderr, "`--threads` needs a number from 1 to %d\n",
+                        MAX_THREADS);
+                usage(argv[0]);
+            }
+            worker_count = n;
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            serving = true;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serving = true;
+            socket_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--max-steps=", 12) == 0) {
+            limit.steps = parse_amount("--max-steps", argv[i] + 12, false,
+                                       argv[0]);
+        } else if (strncmp(argv[i], "--max-memory=", 13) == 0) {
+            limit.memory = parse_amount("--max-memory", argv[i] + 13, true,
+                                        argv[0]);
+        } else if (strncmp(argv[i], "--timeout=", 10) == 0) {
+            char *end;
+            limit.seconds = strtod(argv[i] + 10, &end);
+            if (*end != '\0' || end == argv[i] + 10 || !(limit.seconds > 0)) {
+                fprintf(stderr, "`--timeout` needs a positive number of"
+                        " seconds\n");
+                usage(argv[0]);
+            }
+        } else if (strncmp(argv[i], "--entry=", 8) == 0) {
+            const char *name = argv[i] + 8;
+            size_t len = strlen(name);
+            if (len == 0 || strcspn(name, " \t\n\r.\\()=") != len) {
+                fprintf(stderr, "`--entry` needs the name of a definition\n");
+                usage(argv[0]);
+            }
+            entry_name = intern(name, len);
+        } else if (strncmp(argv[i], "--compile=", 10) == 0) {
+            compile_path = argv[i] + 10;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watching = true;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = true;
+        } else if (strcmp(argv[i], "--output=text") == 0) {
+            output_format = OUTPUT_TEXT;
+        } else if (strcmp(argv[i], "--output=blc") == 0) {
+            output_format = OUTPUT_BLC;
+        } else if (strcmp(argv[i], "--output=blc8") == 0) {
+            output_format = OUTPUT_BLC8;
+        } else if (strcmp(argv[i], "--form=nf") == 0) {
+            eval_form = FORM_NORMAL;
+        } else if (strcmp(argv[i], "--form=hnf") == 0) {
+            eval_form = FORM_HEAD;
+        } else if (strcmp(argv[i], "--form=whnf") == 0) {
+            eval_form = FORM_WEAK_HEAD;
+        } else if (strncmp(argv[i], "--depth=", 8) == 0) {
+            print_depth = parse_amount("--depth", argv[i] + 8, false,
+                                       argv[0]);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        } else if (strncmp(argv[i], "--stats-json=", 13) == 0) {
+            show_stats = true;
+            stats_json = argv[i] + 13;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--", 2) == 0 || file_name != NULL) {
+            fprintf(stderr, "Unknown argument `%s`\n", argv[i]);
+            usage(argv[0]);
+        } else {
+            file_name = argv[i];
+        }
+    }
+    if (file_name == NULL) {
+        fprintf(stderr, "Not enough arguments!\n");
+        usage(argv[0]);
+    }
+    if (show_stats) atexit(print_stats);
+    if (native_enabled && eval_strategy != STRATEGY_STRICT
+        && eval_strategy != STRATEGY_NEED) {
+        fprintf(stderr, "`--native` needs the strict or need strategy\n");
+        usage(argv[0]);
+    }
+    if (serving && entry_name != intern("main", strlen("main"))) {
+        fprintf(stderr, "`--entry` picks what to evaluate, it cannot serve\n");
+        usage(argv[0]);
+    }
+    if (watching && (serving || use_cache || compile_path != NULL
+                     || worker_count > 1)) {
+        fprintf(stderr, "`--watch` cannot be used with `--serve`, `--cache`,"
+                " `--compile` or `--threads`\n");
+        usage(argv[0]);
+    }
+    if (compile_path != NULL && serving) {
+        fprintf(stderr, "`--compile` writes a program, it cannot serve\n");
+        usage(argv[0]);
+    }
+    if (compile_path != NULL && output_format != OUTPUT_TEXT) {
+        fprintf(stderr, "`--compile` writes a program that prints text, it"
+                " cannot use `--output`\n");
+        usage(argv[0]);
+    }
+    if (eval_form != FORM_NORMAL
+        && ((eval_strategy != STRATEGY_STRICT
+             && eval_strategy != STRATEGY_NEED)
+            || native_enabled || compile_path != NULL)) {
+        fprintf(stderr, "`--form` needs the strict or need strategy, without"
+                " `--native` or `--compile`\n");
+        usage(argv[0]);
+    }
+    if (print_depth > 0
+        && (output_format != OUTPUT_TEXT || compile_path != NULL)) {
+        fprintf(stderr, "`--depth` prints text, it cannot be used with"
+                " `--output` or `--compile`\n");
+        usage(argv[0]);
+    }
+    if (profile_path != NULL
+        && (eval_strategy != STRATEGY_STRICT || worker_count > 1)) {
+        fprintf(stderr, "`--profile` needs the strict strategy without"
+                " `--threads`\n");
+        usage(argv[0]);
+    }
+    if (profile_path != NULL
+        && (serving || watching || compile_path != NULL)) {
+        fprintf(stderr, "`--profile` cannot be used with `--serve`,"
+                " `--watch` or `--compile`\n");
+        usage(argv[0]);
+    }
+    // a server uses its threads for connections, not within one query
+    size_t server_threads = 1;
+    if (serving) {
+        server_threads = worker_count;
+        worker_count = 1;
+    }
+    if (worker_count > 1
+        && (eval_strategy != STRATEGY_STRICT || native_enabled)) {
         fprintf(stderr,
-                "ERROR: could not open file: %s (ERRNO %d)\n",
-                strerror(errno), errno);
-        exit(1);
+                "`--threads` needs the strict strategy without `--native`\n");
+        usage(argv[0]);
     }
 
-    list *list = NULL;
-    char *line = NULL;
-    size_t l;
-    ssize_t read;
+    if (watching) watch(file_name, entry_name);
 
-    display_type type = NONE;
+    double start = timer_start();
+    size_t size;
+    const char *src = map_file(file_name, &size);
 
-    while ((read = getline(&line, &l, file)) != -1) {
-        line[read-1] = '\0';
-        line_t *parsed_line = parse_line(line);
-        if (parsed_line != NULL) {
-            if (strcmp(parsed_line->name, "main") == 0) {
-                type = parsed_line->type;
+    table functions = {0};
+    char *cache_path = NULL;
+    uint64_t source_hash = 0;
+    if (use_cache) {
+        cache_path = allocate(strlen(file_name) + sizeof(".cache"));
+        sprintf(cache_path, "%s.cache", file_name);
+        source_hash = hash_name(src, size);
+    }
+    if (!use_cache || !load_cache(cache_path, &functions, source_hash, size)) {
+        lexer lx;
+        lexer_init(&lx, src, size);
+        if (use_cache || serving) {
+            // the cache and queries may use any definition
+            line_t *def;
+            while ((def = parse_definition(&lx)) != NULL) {
+                set(&functions, def);
+                free(def);
+                stats.parsed++;
             }
-            set(&list, parsed_line);
+        } else {
+            source_list defs = {0};
+            source_index index = {0};
+            while (index_next(&lx, &defs)) {}
+            index_by_name(&defs, &index);
+            parse_reachable(&functions, src, size, &index, entry_name, false);
+            free(defs.items);
+            free(index.items);
         }
-        free(line);
-        line = NULL;
+        if (use_cache) save_cache(cache_path, &functions, source_hash, size);
     }
+    // normal forms strict evaluation keeps beyond these are saved at the end
+    size_t cached_normals = use_cache ? kept_normals(&functions) : 0;
+    if (size > 0) munmap((void*)src, size);
+    timer_stop(start, &stats.parse_time);
 
-    eval_line(list, "main");
-    term *t = get(list, "main");
-
-    switch (type) {
-    case TYPE_INT:
-        if (t->type == TYPE_ABSTRACTION) {
-            const char *arg1 = t->value.abstraction.arg;
-            if (t->value.abstraction.term->type == TYPE_ABSTRACTION) {
-                const char *arg2 = t->value.abstraction.term->
-                    value.abstraction.arg;
-                term *current_body = t->value.abstraction.term->
-                    value.abstraction.term;
-                bool invalid = false;
-                for (unsigned long long int i = 0;;i++) {
-                    if (current_body->type == TYPE_APPLICATION) {
-                        term *left = current_body->value.application.left;
-                        if (left->type == TYPE_VARIABLE &&
-                            strcmp(left->value.var, arg1) == 0) {
-                            current_body = current_body->
-                                value.application.right;
-                            continue;
-                        } else {
-                            invalid = true;
-                            break;
-                        }
-                    } else if (current_body->type == TYPE_VARIABLE) {
-                        if (strcmp(current_body->value.var, arg2) == 0) {
-                            printf("%lld\n", i);
-                            invalid = false;
-                            break;
-                        } else {
-                            invalid = true;
-                            break;
-                        }
-                    } else {
-                        invalid = true;
-                        break;
-                    }
-                }
-                if (!invalid) break;
-                dump(t);
-                break;
+    if (serving) {
+        if (native_enabled) {
+            // recognise everything up front, so the threads only read it
+            for (size_t k = 0; k < NATIVE_PATTERNS; k++) native_pattern(k);
+            for (size_t i = 0; i < functions.cap; i++) {
+                symbol name = functions.slots[i].name;
+                if (name != NO_SYMBOL) classify(&functions, name);
             }
         }
-        dump(t);
-        break;
-    case TYPE_BOOL:
-        if (t->type == TYPE_ABSTRACTION) {
-            if (t->value.abstraction.term->type == TYPE_ABSTRACTION) {
-                if (strcmp(t->value.abstraction.arg,
-                           t->value.abstraction.term->
-                           value.abstraction.term->value.
-                           abstraction.arg) == 0) {
-                    printf("true\n");
-                    break;
-                } else if (strcmp(t->value.abstraction.term->
-                                  value.abstraction.arg,
-                                  t->value.abstraction.term->
-                                  value.abstraction.term->
-                                  value.abstraction.arg
-                                  ) == 0) {
-                    printf("false\n");
-                    break;
-                }
-            }
+        if (socket_path != NULL) {
+            serve_socket(&functions, socket_path, server_threads);
         }
-        dump(t);
-        break;
-    default:
-        dump(t);
-        break;
+        if (server_threads > 1) {
+            serve_parallel(&functions, stdin, stdout, server_threads);
+        } else {
+            serve(&functions, stdin, stdout);
+        }
+        if (use_cache && kept_normals(&functions) > cached_normals) {
+            save_cache(cache_path, &functions, source_hash, size);
+        }
+        free(cache_path);
+        return 0;
+    }
+
+    line_t *main_line = lookup(&functions, entry_name);
+    if (main_line == NULL) {
+        fprintf(stderr, "ERROR: `%s` does not define `%s`\n", file_name,
+                symbol_name(entry_name));
+        exit(1);
+    }
+    if (compile_path != NULL) {
+        compile_c(&functions, main_line, compile_path);
+        free(cache_path);
+        return 0;
+    }
+
+    // readback is timed on its own inside
+    start = timer_start();
+    main_line->term = unpack(main_line->body, false);
+    if (profile_path != NULL) {
+        // written even if a limit stops evaluation
+        atexit(write_profile);
+        profile_start(main_line->name);
+    }
+    eval_line(&functions, main_line);
+    profile_stop();
+    timer_stop(start, &stats.eval_time);
+    stats.eval_time -= stats.readback_time;
+
+    start = timer_start();
+    print_result(stdout, &functions, main_line);
+    timer_stop(start, &stats.print_time);
+
+    if (use_cache && kept_normals(&functions) > cached_normals) {
+        save_cache(cache_path, &functions, source_hash, size);
     }
+    free(cache_path);
 }
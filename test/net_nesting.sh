@@ -0,0 +1,18 @@
+#!/bin/sh
+# The interaction net of a term must grow with its size, not with the square
+# of how deep its arguments are nested: bench/deep_nesting.lc nests 60000
+# arguments, and under the net strategy has to give what strict gives well
+# within the limits below.
+# Usage: test/net_nesting.sh <evaluator>
+main=${1:-./main}
+dir=$(dirname "$0")
+file="$dir/../bench/deep_nesting.lc"
+
+expected=$("$main" "$file")
+actual=$("$main" --strategy=net --timeout=20 --max-memory=500M "$file" 2>&1)
+if [ "$actual" != "$expected" ]; then
+    echo "FAIL: --strategy=net on deep_nesting.lc"
+    echo "$actual"
+    exit 1
+fi
+echo "ok: --strategy=net on deep_nesting.lc"
@@ -0,0 +1,125 @@
+#!/bin/sh
+# Every way of evaluating a file must print what the default one does:
+# main.lc and each workload in bench/ under every strategy, and the ways the
+# result can be saved, printed or compiled must give it back unchanged.
+# Usage: test/outputs.sh <evaluator>
+main=${1:-./main}
+dir=$(dirname "$0")
+cc=${CC:-cc}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+status=0
+
+# compares what a check printed with what it should have
+same() {
+    if [ "$2" != "$3" ]; then
+        echo "FAIL: $1"
+        printf '%s\n' "$3" | head -c 300
+        echo
+        status=1
+    else
+        echo "ok: $1"
+    fi
+}
+
+# Strategies. The net strategy is left out of ski_doubling.lc, whose
+# bookkeeping grows with the square of the numeral (see the README).
+for file in "$dir/../main.lc" "$dir"/../bench/*.lc; do
+    name=$(basename "$file")
+    expected=$("$main" "$file")
+    for flags in --strategy=need --strategy=machine --strategy=bytecode \
+                 --strategy=hashcons --strategy=net --native \
+                 "--strategy=need --native" --threads=4; do
+        case "$name $flags" in
+        "ski_doubling.lc --strategy=net") continue ;;
+        esac
+        # shellcheck disable=SC2086
+        same "$flags $name" "$expected" "$("$main" $flags "$file" 2>&1)"
+    done
+done
+
+# --entry, and text that parses back: a normal form printed as the body of
+# a definition evaluates to itself.
+normal=$("$main" --entry=420 "$dir/../main.lc")
+printf 'main = %s\n' "$normal" > "$tmp/normal.lc"
+same "--entry=420 parses back" "$normal" "$("$main" "$tmp/normal.lc")"
+same "--entry=5" '\f.\v.(f)((f)((f)((f)((f)(v)))))' \
+    "$("$main" --entry=5 "$dir/../main.lc")"
+
+# Binary lambda calculus: the term and the one its text parses back to are
+# encoded alike, and blc8 packs the same bits, eight to a byte.
+bits=$("$main" --output=blc --entry=420 "$dir/../main.lc")
+same "--output=blc round trip" "$bits" \
+    "$("$main" --output=blc "$tmp/normal.lc")"
+packed=$("$main" --output=blc8 --entry=420 "$dir/../main.lc" | od -An -v -tu1 \
+    | awk '{ for (i = 1; i <= NF; i++) for (b = 128; b >= 1; b /= 2)
+                 printf "%d", int($i / b) % 2 }')
+padded=$(printf '%s' "$bits" | awk '{ while (length($0) % 8) $0 = $0 "0"; print }')
+same "--output=blc8 packs --output=blc" "$padded" "$packed"
+
+# --form and --depth: a normal form is already in weak head and head normal
+# form, and a deep enough cut is no cut at all.
+for form in whnf hnf; do
+    same "--form=$form of a normal form" "$normal" \
+        "$("$main" --form=$form "$tmp/normal.lc")"
+done
+same "--form=whnf stops at the head" '\f.\v.(f)(((((2)(succ))(2))(f))(v))' \
+    "$("$main" --strategy=need --form=whnf --entry=5 "$dir/../main.lc")"
+same "--depth=2" '\f.\v....' "$("$main" --depth=2 --entry=420 "$dir/../main.lc")"
+same "--depth=1000" "$normal" \
+    "$("$main" --depth=1000 --entry=420 "$dir/../main.lc")"
+"$main" --form=whnf "$dir/../main.lc" > /dev/null 2>&1
+same "--form=whnf rejects a num result" 1 $?
+
+# --cache: written on the first run, read on the next ones, and written
+# again once strict evaluation kept normal forms it did not have.
+cp "$dir/../main.lc" "$tmp/cached.lc"
+expected=$("$main" "$tmp/cached.lc")
+parsed() {
+    "$main" --cache --stats "$tmp/cached.lc" 2>&1 >/dev/null \
+        | awk '$1 == "parsed" { print $2 }'
+}
+definitions=$(parsed)
+rm "$tmp/cached.lc.cache"
+for run in 1 2 3; do
+    for strategy in strict need; do
+        same "--cache run $run, $strategy" "$expected" \
+            "$("$main" --cache --strategy=$strategy "$tmp/cached.lc")"
+    done
+done
+same "--cache parses nothing once written" 0 "$(parsed)"
+echo "-- changed" >> "$tmp/cached.lc"
+same "--cache parses a changed file again" "$definitions" "$(parsed)"
+
+# --compile: the C program prints what the evaluator does. deep_nesting.lc
+# is left out only because the C compiler takes long on it.
+for file in "$dir/../main.lc" "$dir/../bench/church_28980.lc" \
+            "$dir/../bench/bool_chain.lc" "$dir/../bench/ski_identity.lc"; do
+    name=$(basename "$file")
+    "$main" --compile="$tmp/prog.c" "$file"
+    if ! "$cc" -O2 "$tmp/prog.c" -o "$tmp/prog"; then
+        same "--compile $name builds" 0 1
+        continue
+    fi
+    same "--compile $name" "$("$main" "$file")" "$("$tmp/prog")"
+done
+
+# --watch: evaluates at once, then again after the file changes.
+cp "$dir/../main.lc" "$tmp/watched.lc"
+"$main" --watch "$tmp/watched.lc" > "$tmp/watch.out" 2>&1 &
+pid=$!
+wait_lines() {
+    tries=0
+    while [ "$(wc -l < "$tmp/watch.out")" -lt "$1" ] && [ $tries -lt 100 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+}
+wait_lines 1
+sed 's/^main num = 420$/main num = 69/' "$dir/../main.lc" > "$tmp/watched.lc"
+wait_lines 2
+kill "$pid"
+wait "$pid" 2>/dev/null
+same "--watch" "$(printf '420\n69')" "$(cat "$tmp/watch.out")"
+
+exit $status
@@ -0,0 +1,26 @@
+#!/bin/sh
+# A query stopped by the memory limit must not break the queries after it:
+# each strategy is asked for 4^16, which needs far more than the limit, and
+# then for 420 * 420, which fits, twice over on one server.
+# Usage: test/serve_limits.sh <evaluator>
+main=${1:-./main}
+dir=$(dirname "$0")
+status=0
+
+check() {
+    expected=$(printf 'ERROR\n176400\nERROR\n176400')
+    actual=$(printf 'num = ^ 4 (* 4 4)\nnum = * 420 420\nnum = ^ 4 (* 4 4)\nnum = * 420 420\n' \
+        | "$main" --serve "$@" "$dir/../main.lc" | sed 's/^ERROR.*/ERROR/')
+    if [ "$actual" != "$expected" ]; then
+        echo "FAIL: $*"
+        echo "$actual"
+        status=1
+    else
+        echo "ok: $*"
+    fi
+}
+
+for strategy in strict need machine bytecode hashcons; do
+    check --strategy=$strategy --max-memory=100M
+done
+exit $status
@@ -0,0 +1,38 @@
+#!/bin/sh
+# A server's memory must not grow with the number of queries it answered:
+# each query below makes a numeral of 176400 nodes over a fresh free name,
+# which the hash-consed graph would otherwise keep for good. The peak RSS
+# after 40 queries must stay within half again of the peak after 10.
+# Usage: test/serve_memory.sh <evaluator>
+main=${1:-./main}
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkfifo "$tmp/in"
+
+"$main" --serve --strategy=hashcons "$dir/../main.lc" < "$tmp/in" > "$tmp/out" &
+pid=$!
+exec 3> "$tmp/in"
+
+# sends queries up to number $1 and waits for their answers, then prints
+# the server's peak RSS in kB
+ask() {
+    while [ "$sent" -lt "$1" ]; do
+        sent=$((sent + 1))
+        echo "true z$sent ((* 420 420) s z$sent)" >&3
+    done
+    while [ "$(wc -l < "$tmp/out")" -lt "$1" ]; do sleep 0.1; done
+    awk '/^VmHWM/ { print $2 }' "/proc/$pid/status"
+}
+
+sent=0
+early=$(ask 10)
+late=$(ask 40)
+exec 3>&-
+wait "$pid"
+
+if [ "$late" -gt $((early + early / 2)) ]; then
+    echo "FAIL: peak RSS grew from ${early} kB after 10 queries to ${late} kB after 40"
+    exit 1
+fi
+echo "ok: peak RSS ${early} kB after 10 queries, ${late} kB after 40"